@@ -261,18 +261,23 @@ do_kill_lsm() if $KILL;
 my %SERVICES = map {$_=>1} $bal->isp_services;
 
 my %LSM_STATE = (up              => 'up',
+		 degraded        => 'degraded',
 		 down            => 'down',
 		 long_down       => 'down',
 		 long_down_to_up => 'up');
 
-if (exists $LSM_STATE{$ARGV[0]}) {
+# a single lsm event, or all the events of one lsm decision pass in a batch
+if (@ARGV && ($ARGV[0] eq 'batch' || exists $LSM_STATE{$ARGV[0]})) {
+    my @events = $bal->lsm_events(@ARGV);
     do_unlock($lock_fh);    # to allow eventd to call us recursively
-    $bal->run_eventd(@ARGV);
+    $bal->run_eventd(@$_) foreach @events;
     $lock_fh = do_lock();
-    if (($SERVICES{my $name = $ARGV[1]})) {
-	my $device = $ARGV[3] || $bal->dev($name);
-	syslog('warning',"$name ($device) is now in state '$ARGV[0]'.");
-	$bal->event($name => $LSM_STATE{$ARGV[0]}) if $LSM_STATE{$ARGV[0]};
+    for my $event (@events) {
+	my ($state,$name,undef,$device) = @$event;
+	next unless $SERVICES{$name};
+	$device ||= $bal->dev($name);
+	syslog('warning',"$name ($device) is now in state '$state'.");
+	$bal->event($name => $LSM_STATE{$state}) if $LSM_STATE{$state};
     }
 }
 
@@ -299,6 +304,7 @@ exit 0;
 
 sub do_status {
     my $state = $bal->event();
+    my %up    = map {$_=>1} $bal->up;
     my @svc = sort $bal->isp_services;
     printf("%-12s %-12s %-12s %-3s\n",
 	   'Service',
@@ -308,7 +314,7 @@ sub do_status {
     foreach (@svc) {
 	my $preferred = $bal->preferred_service;
 	my $routing   = $bal->operating_mode eq 'failover' ? $_ eq $preferred
-	                                                   : $state->{$_} eq 'up';
+	                                                   : $up{$_};
 	printf("%-12s %-12s %-12s %-3s\n",
 		   $_,
 		   $bal->vdev($_),
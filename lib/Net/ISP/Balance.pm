@@ -172,6 +172,51 @@ These define the minimum and maximum numbers of
 successively-transmitted pings that must be returned in order to
 declare a link up or down. 
 
+=item followed_pkts=<integer>
+
+The number of most recent pings the packet loss and successive ping
+counts are taken over, 100 by default. A short window reacts faster
+to a failing link, a long one rides out brief losses on a flaky one.
+
+=item loss_window_s=<integer>
+
+=item max_loss_pct=<integer>
+
+=item min_loss_pct=<integer>
+
+Count the packet loss as a percentage of the pings sent over the last
+loss_window_s seconds instead of over followed_pkts pings. The link is
+declared down when the loss is more than max_loss_pct (20 by default),
+and may come back up once it is min_loss_pct (5 by default) or less.
+These then replace max_packet_loss and min_packet_loss, so the ping
+interval can be changed without retuning them.
+
+=item max_no_reply_ms=<integer>
+
+=item min_reply_run_ms=<integer>
+
+The same for the successive ping counts: declare the link down when no
+reply has come for max_no_reply_ms milliseconds, and let it come back
+up only once replies have come without a miss for min_reply_run_ms.
+
+=item max_rtt_ms=<integer>
+
+=item min_rtt_ms=<integer>
+
+=item rtt_percentile=<integer>
+
+A link that is up is declared degraded when the given percentile (50,
+95 or 99, 95 by default) of its ping round trip times rises above
+max_rtt_ms milliseconds, and up again once it falls to min_rtt_ms or
+below. A degraded link is drained of traffic while other links are
+up. The check is off when max_rtt_ms is 0, the default.
+
+=item max_jitter_ms=<integer>
+
+=item min_jitter_ms=<integer>
+
+The same for the jitter of the round trip times.
+
 =item long_down_time=<integer>
 
 This is a value in seconds after a service that has gone down is
@@ -214,6 +259,7 @@ sub new {
 	dummy_data         => $options{dummy_test_data},
 	dev_lookup_retries => $options{dev_lookup_retries},
 	dev_lookup_retry_delay => $options{dev_lookup_retry_delay},
+	lsm_state_dir      => $options{lsm_state_dir},
     },ref $class || $class;
 
     $self->_parse_configuration_file($conf);
@@ -503,6 +549,20 @@ sub dev_lookup_retry_delay {
     $d;
 }
 
+=head2 $dir = $bal->lsm_state_dir([$dir])
+
+Get/set the directory in which event() keeps the state of each
+service. Default is /var/lib/lsm.
+
+=cut
+
+sub lsm_state_dir {
+    my $self = shift;
+    my $d    = $self->{lsm_state_dir} || '/var/lib/lsm';
+    $self->{lsm_state_dir} = shift if @_;
+    $d;
+}
+
 =head2 $boolean = $bal->keep_custom_chains([boolean]);
 
 Get/set the keep_custom_chains flag. If this is true (default), then
@@ -989,15 +1049,22 @@ sub lan_services {
 
 =head2 $state = $bal->event($service => $new_state)
 
-Record a transition between "up" and "down" for a named service. The
-first argument is the name of the ISP service that has changed,
-e.g. "CABLE". The second argument is either "up" or "down".
+Record a transition between "up", "degraded" and "down" for a named
+service. The first argument is the name of the ISP service that has
+changed, e.g. "CABLE". The second argument is one of "up", "degraded"
+or "down".
 
 The method returns a hashref in which the keys are the ISP service names
-and the values are one of 'up' or 'down'.
+and the values are one of 'up', 'degraded' or 'down'.
+
+Traffic is balanced across the services that are up. A degraded
+service, one that still answers but whose latency or jitter is over
+the limits set in the lsm configuration, is drained of traffic, unless
+no service is up at all, in which case the degraded ones are used.
 
-The persistent state information is stored in /var/lib/lsm/ under a
-series of files named <SERVICE_NAME>.state.
+The persistent state information is stored in /var/lib/lsm/, or the
+directory set with lsm_state_dir(), under a series of files named
+<SERVICE_NAME>.state.
 
 =cut
 
@@ -1006,9 +1073,9 @@ sub event {
 
     if (@_) {
 	my ($svc,$new_state) = @_;
-	$new_state =~ /^(up|down)$/  or croak "state must be 'up' or  down'";
+	$new_state =~ /^(up|degraded|down)$/  or croak "state must be 'up', 'degraded' or 'down'";
 	$self->vdev($svc)            or croak "service '$svc' is unknown";
-	my $file = "/var/lib/lsm/${svc}.state";
+	my $file = $self->lsm_state_dir."/${svc}.state";
 	my $mode = -e $file ? '+<' : '>';
 	open my $fh,$mode,$file or croak "Couldn't open $file mode $mode: $!";
 	flock $fh,LOCK_EX;
@@ -1020,7 +1087,7 @@ sub event {
 
     my %state;
     for my $svc ($self->isp_services) {
-	my $file = "/var/lib/lsm/${svc}.state";
+	my $file = $self->lsm_state_dir."/${svc}.state";
 	if (open my $fh,'<',$file) {
 	    flock $fh,LOCK_SH;
 	    my $state = <$fh>;
@@ -1031,6 +1098,7 @@ sub event {
 	}
     }
     my @up = grep {$state{$_} eq 'up'} keys %state;
+    @up    = grep {$state{$_} eq 'degraded'} keys %state unless @up;
     $self->up(@up);
     return \%state;
 }
@@ -1041,6 +1109,7 @@ Runs scripts in response to lsm events. The scripts are stored in
 directories named after the events, e.g.:
 
  /etc/network/lsm/up.d/*
+ /etc/network/lsm/degraded.d/*
  /etc/network/lsm/down.d/*
  /etc/network/lsm/long_down.d/*
 
@@ -1080,6 +1149,30 @@ sub run_eventd {
     }    
 }
 
+=head2 @events = $bal->lsm_events(@args)
+
+Splits the arguments an lsm eventscript was called with into one array
+reference per event, each holding the arguments listed under
+run_eventd(). When lsm runs with batch_events=1, all the changes of
+one decision pass arrive in a single call of the form:
+
+ batch COUNT ARGS_OF_EVENT_1 ARGS_OF_EVENT_2 ...
+
+A plain single event call gives a list of one.
+
+=cut
+
+sub lsm_events {
+    my $self = shift;
+    my @args = @_;
+    return [@args] unless @args && $args[0] eq 'batch';
+
+    my (undef,$count,@fields) = @args;
+    return unless $count;
+    my $per = @fields / $count;
+    return map {[@fields[$_*$per .. ($_+1)*$per-1]]} 0..$count-1;
+}
+
 =head2 @up = $bal->up(@up_services)
 
 Get or set the list of ISP interfaces that are currently active and
@@ -1373,6 +1466,17 @@ Possible switches and their defaults are:
     -min_successive_pkts_rcvd   10
     -interval_ms              1000
     -timeout_ms               1000
+    -followed_pkts             100
+    -max_rtt_ms                  0 <no latency check>
+    -min_rtt_ms                  0
+    -rtt_percentile             95
+    -max_jitter_ms               0 <no jitter check>
+    -min_jitter_ms               0
+    -loss_window_s               0 <loss counted over followed_pkts>
+    -max_loss_pct               20
+    -min_loss_pct                5
+    -max_no_reply_ms             0 <use max_successive_pkts_lost>
+    -min_reply_run_ms            0 <use min_successive_pkts_rcvd>
     -warn_email               root
     -check_arp                   0
     -sourceip                 <autodiscovered>
@@ -1380,6 +1484,10 @@ Possible switches and their defaults are:
     -ttl                      0 <use system value>
     -status                   2 <no assumptions>
     -debug                    8 <moderate verbosity from scale of 0 to 100>
+    -max_pps                  0 <no global cap on probes per second>
+    -io_uring                 0 <probe through epoll>
+    -event_decisions          0 <decide once a second>
+    -batch_events             0 <one eventscript call per change>
 
 =cut
 
@@ -1412,8 +1520,13 @@ sub lsm_config_text {
 
     my $result = "# This file is autogenerated by load_balancer.pl when it first runs.\n";
     $result   .= "# Do not edit directly. Instead edit /etc/network/balance.conf.\n\n";
-    $result   .= "debug=$defaults{-debug}\n\n";
-    delete $defaults{-debug};
+    $result   .= "debug=$defaults{-debug}\n";
+    $result   .= "max_pps=$defaults{-max_pps}\n" if defined $defaults{-max_pps};
+    $result   .= "io_uring=$defaults{-io_uring}\n" if defined $defaults{-io_uring};
+    $result   .= "event_decisions=$defaults{-event_decisions}\n" if defined $defaults{-event_decisions};
+    $result   .= "batch_events=$defaults{-batch_events}\n" if defined $defaults{-batch_events};
+    $result   .= "\n";
+    delete @defaults{qw(-debug -max_pps -io_uring -event_decisions -batch_events)};
 
     $result .= "defaults {\n";
     $result .= " name=defaults\n";
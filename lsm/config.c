@@ -58,6 +58,10 @@ static int eqcmp(char *str, char *pat)
 	return 1;
 }
 
+/* settings of the named exec queues, queues without a block run one script at a time */
+static QUEUE_CFG *queue_cfgs = NULL;
+static QUEUE_CFG default_queue_cfg = { NULL, 1, 0, 5000, 0, 1, NULL };
+
 int reload_config(char *fn, CONFIG **first, CONFIG **last, GROUPS **firstg, GROUPS **lastg) {
 	free_config(first, last, firstg, lastg);
 	init_config();
@@ -121,6 +125,14 @@ void free_config(CONFIG **first, CONFIG **last, GROUPS **firstg, GROUPS **lastg)
 	*firstg = NULL;
 	*lastg = NULL;
 
+	while(queue_cfgs) {
+		QUEUE_CFG *prevq = queue_cfgs;
+
+		queue_cfgs = queue_cfgs->next;
+		free(prevq->name);
+		free(prevq);
+	}
+
 	if(defaults.name)                   release(&defaults.name);
 	if(defaults.checkip)                release(&defaults.checkip);
 	if(defaults.eventscript)            release(&defaults.eventscript);
@@ -144,6 +156,18 @@ void init_config(void)
 	/* initialize to sane value */
 	cfg.debug = 8;
 
+	/* no global send rate cap */
+	cfg.max_pps = 0;
+
+	/* probe through epoll unless io_uring is asked for */
+	cfg.io_uring = 0;
+
+	/* decide once a second unless asked to decide as probe outcomes come in */
+	cfg.event_decisions = 0;
+
+	/* one eventscript run per transition unless asked to batch them */
+	cfg.batch_events = 0;
+
 	defaults.name = strdup("defaults");
 	defaults.checkip = strdup("127.0.0.1");
 	defaults.eventscript = NULL;
@@ -154,11 +178,33 @@ void init_config(void)
 	defaults.min_successive_pkts_rcvd = 10;
 	defaults.interval_ms = 1000;
 	defaults.timeout_ms = 1000;
+	defaults.followed_pkts = FOLLOWED_PKTS;
+
+	/* latency and jitter do not degrade a connection unless asked to */
+	defaults.max_rtt_ms = 0;
+	defaults.min_rtt_ms = 0;
+	defaults.rtt_percentile = 95;
+	defaults.max_jitter_ms = 0;
+	defaults.min_jitter_ms = 0;
+
+	/* loss is counted over followed_pkts unless a span of time is given */
+	defaults.loss_window_s = 0;
+	defaults.max_loss_pct = 20;
+	defaults.min_loss_pct = 5;
+	defaults.max_no_reply_ms = 0;
+	defaults.min_reply_run_ms = 0;
+
 	defaults.warn_email = strdup("root");
 	defaults.check_arp = 0;
 	defaults.sourceip = NULL;
 	defaults.ttl = 0;
 
+	/* by default every connection opens its own socket */
+	defaults.shared_socket = 0;
+
+	/* by default probe with raw sockets */
+	defaults.ping_socket = 0;
+
 	/* assume default unknown state for connections unless user has stated otherwise later in config */
 	defaults.status = UNKNOWN;
 
@@ -232,6 +278,7 @@ int read_config(char *fn, CONFIG **first, CONFIG **last, GROUPS **firstg, GROUPS
 	CONFIG *cur = NULL;
 	GROUPS *curg = NULL;
 	GROUP_MEMBERS *curgm = NULL;
+	QUEUE_CFG *curq;
 
 	errors = 0;
 
@@ -271,17 +318,80 @@ int read_config(char *fn, CONFIG **first, CONFIG **last, GROUPS **firstg, GROUPS
 			errors++;
 		}
 
+		if(cur->followed_pkts < 2 || cur->followed_pkts > MAX_FOLLOWED_PKTS) {
+			syslog(LOG_ERR, "WARNING: connection \"%s\" followed_pkts (%d) must be between 2 and %d", cur->name, cur->followed_pkts, MAX_FOLLOWED_PKTS);
+			errors++;
+		} else if(cur->min_successive_pkts_rcvd > cur->followed_pkts) {
+			syslog(LOG_ERR, "WARNING: connection \"%s\" min_successive_pkts_rcvd (%d) > followed_pkts (%d). connection would never come up", cur->name, cur->min_successive_pkts_rcvd, cur->followed_pkts);
+			errors++;
+		}
+
+		if(cur->rtt_percentile != 50 && cur->rtt_percentile != 95 && cur->rtt_percentile != 99) {
+			syslog(LOG_ERR, "WARNING: connection \"%s\" rtt_percentile (%d) must be 50, 95 or 99", cur->name, cur->rtt_percentile);
+			errors++;
+		}
+
+		if(cur->max_rtt_ms && (cur->min_rtt_ms <= 0 || cur->max_rtt_ms <= cur->min_rtt_ms)) {
+			syslog(LOG_ERR, "WARNING: connection \"%s\" max_rtt_ms (%d) needs a min_rtt_ms (%d) between 0 and it. that would cause flip-flop effect", cur->name, cur->max_rtt_ms, cur->min_rtt_ms);
+			errors++;
+		}
+
+		if(cur->loss_window_s < 0 || cur->loss_window_s > 86400) {
+			syslog(LOG_ERR, "WARNING: connection \"%s\" loss_window_s (%d) must be between 0 and 86400", cur->name, cur->loss_window_s);
+			errors++;
+		} else if(cur->loss_window_s && (cur->min_loss_pct < 0 || cur->max_loss_pct > 100 || cur->max_loss_pct <= cur->min_loss_pct)) {
+			syslog(LOG_ERR, "WARNING: connection \"%s\" max_loss_pct (%d) and min_loss_pct (%d) must be within 0 to 100 with min below max. that would cause flip-flop effect", cur->name, cur->max_loss_pct, cur->min_loss_pct);
+			errors++;
+		}
+
+		if(cur->max_jitter_ms && (cur->min_jitter_ms <= 0 || cur->max_jitter_ms <= cur->min_jitter_ms)) {
+			syslog(LOG_ERR, "WARNING: connection \"%s\" max_jitter_ms (%d) needs a min_jitter_ms (%d) between 0 and it. that would cause flip-flop effect", cur->name, cur->max_jitter_ms, cur->min_jitter_ms);
+			errors++;
+		}
+
+	}
+
+	for(curq = queue_cfgs; curq; curq = curq->next) {
+		if(!curq->name || !*curq->name) {
+			syslog(LOG_ERR, "WARNING: queue without a name");
+			errors++;
+			continue;
+		}
+
+		if(curq->max_running < 1) {
+			syslog(LOG_ERR, "WARNING: queue \"%s\" max_running (%d) must be at least 1", curq->name, curq->max_running);
+			errors++;
+		}
+
+		if(curq->deadline_ms < 0 || curq->kill_grace_ms < 0 || curq->max_depth < 0) {
+			syslog(LOG_ERR, "WARNING: queue \"%s\" deadline_ms (%d), kill_grace_ms (%d) and max_depth (%d) can not be negative", curq->name, curq->deadline_ms, curq->kill_grace_ms, curq->max_depth);
+			errors++;
+		}
 	}
+
 	if(errors) return(-1);
 
 	return(0);
 }
 
+/* settings of the named queue, the defaults when it has no queue block */
+QUEUE_CFG *find_queue_config(const char *name)
+{
+	QUEUE_CFG *curq;
+
+	for(curq = queue_cfgs; curq; curq = curq->next) {
+		if(curq->name && !strcmp(curq->name, name)) return(curq);
+	}
+
+	return(&default_queue_cfg);
+}
+
 static void read_one_config(char *fn, CONFIG **first, CONFIG **last, GROUPS **firstg, GROUPS **lastg)
 {
 	CONFIG *cur = NULL;
 	GROUPS *curg = NULL;
 	GROUP_MEMBERS *curgm = NULL;
+	QUEUE_CFG *curq = NULL;
 	FILE *fp;
 	char buf[BUFSIZ];
 	int mode = 0;
@@ -338,6 +448,28 @@ static void read_one_config(char *fn, CONFIG **first, CONFIG **last, GROUPS **fi
 					defaults.interval_ms = atoi(strchr(buf, '=') + 1);
 				else if(!eqcmp(buf, "timeout_ms"))
 					defaults.timeout_ms = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "followed_pkts"))
+					defaults.followed_pkts = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "max_rtt_ms"))
+					defaults.max_rtt_ms = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "min_rtt_ms"))
+					defaults.min_rtt_ms = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "rtt_percentile"))
+					defaults.rtt_percentile = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "max_jitter_ms"))
+					defaults.max_jitter_ms = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "min_jitter_ms"))
+					defaults.min_jitter_ms = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "loss_window_s"))
+					defaults.loss_window_s = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "max_loss_pct"))
+					defaults.max_loss_pct = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "min_loss_pct"))
+					defaults.min_loss_pct = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "max_no_reply_ms"))
+					defaults.max_no_reply_ms = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "min_reply_run_ms"))
+					defaults.min_reply_run_ms = atoi(strchr(buf, '=') + 1);
 
 				else if(!eqcmp(buf, "warn_email"))
 					reassign(&defaults.warn_email, strchr(buf, '=') + 1);
@@ -350,6 +482,10 @@ static void read_one_config(char *fn, CONFIG **first, CONFIG **last, GROUPS **fi
 					reassign(&defaults.device, strchr(buf, '=') + 1);
 				else if(!eqcmp(buf, "ttl"))
 					defaults.ttl = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "shared_socket"))
+					defaults.shared_socket = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "ping_socket"))
+					defaults.ping_socket = atoi(strchr(buf, '=') + 1);
 				else if(!eqcmp(buf, "status"))
 					defaults.status = atoi(strchr(buf, '=') + 1);
 
@@ -398,6 +534,17 @@ static void read_one_config(char *fn, CONFIG **first, CONFIG **last, GROUPS **fi
 				else if(!eqcmp(buf, "min_successive_pkts_rcvd"))   cur->min_successive_pkts_rcvd      = atoi(strchr(buf, '=') + 1);
 				else if(!eqcmp(buf, "interval_ms"))                cur->interval_ms                   = atoi(strchr(buf, '=') + 1);
 				else if(!eqcmp(buf, "timeout_ms"))                 cur->timeout_ms                    = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "followed_pkts"))              cur->followed_pkts                 = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "max_rtt_ms"))                 cur->max_rtt_ms                    = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "min_rtt_ms"))                 cur->min_rtt_ms                    = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "rtt_percentile"))             cur->rtt_percentile                = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "max_jitter_ms"))              cur->max_jitter_ms                 = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "min_jitter_ms"))              cur->min_jitter_ms                 = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "loss_window_s"))              cur->loss_window_s                 = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "max_loss_pct"))               cur->max_loss_pct                  = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "min_loss_pct"))               cur->min_loss_pct                  = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "max_no_reply_ms"))            cur->max_no_reply_ms               = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "min_reply_run_ms"))           cur->min_reply_run_ms              = atoi(strchr(buf, '=') + 1);
 
 				else if(!eqcmp(buf, "warn_email"))                 cur->warn_email                    = strdup(strchr(buf, '=') + 1);
 
@@ -405,6 +552,8 @@ static void read_one_config(char *fn, CONFIG **first, CONFIG **last, GROUPS **fi
 				else if(!eqcmp(buf, "sourceip"))                   cur->sourceip                      = strdup(strchr(buf, '=') + 1);
 				else if(!eqcmp(buf, "device"))                     cur->device                        = strdup(strchr(buf, '=') + 1);
 				else if(!eqcmp(buf, "ttl"))                        cur->ttl                           = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "shared_socket"))              cur->shared_socket                 = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "ping_socket"))                cur->ping_socket                   = atoi(strchr(buf, '=') + 1);
 				else if(!eqcmp(buf, "status"))                     cur->status                        = atoi(strchr(buf, '=') + 1);
 				else if(!eqcmp(buf, "queue"))                      cur->queue                         = strdup(strchr(buf, '=') + 1);
 
@@ -456,6 +605,18 @@ static void read_one_config(char *fn, CONFIG **first, CONFIG **last, GROUPS **fi
 					errors++;
 				}
 				break;
+			case 4: /* queue */
+				if(!eqcmp(buf, "name"))                            curq->name                           = strdup(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "max_running"))                curq->max_running                    = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "deadline_ms"))                curq->deadline_ms                    = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "kill_grace_ms"))              curq->kill_grace_ms                  = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "max_depth"))                  curq->max_depth                      = atoi(strchr(buf, '=') + 1);
+				else if(!eqcmp(buf, "drop_oldest"))                curq->drop_oldest                    = atoi(strchr(buf, '=') + 1);
+				else {
+					syslog(LOG_ERR, "%s: %s: unrecognised queue config option on line %d \"%s\"", __FILE__, __FUNCTION__, line, buf);
+					errors++;
+				}
+				break;
 			default:
 				syslog(LOG_ERR, "%s: %s: switch(mode) hit default: should never happen. mode was %d", __FILE__, __FUNCTION__, mode);
 				errors++;
@@ -466,6 +627,14 @@ static void read_one_config(char *fn, CONFIG **first, CONFIG **last, GROUPS **fi
 			/* global config */
 			if(!eqcmp(buf, "debug"))
 				cfg.debug = atoi(strchr(buf, '=') + 1);
+			else if(!eqcmp(buf, "max_pps"))
+				cfg.max_pps = atoi(strchr(buf, '=') + 1);
+			else if(!eqcmp(buf, "io_uring"))
+				cfg.io_uring = atoi(strchr(buf, '=') + 1);
+			else if(!eqcmp(buf, "event_decisions"))
+				cfg.event_decisions = atoi(strchr(buf, '=') + 1);
+			else if(!eqcmp(buf, "batch_events"))
+				cfg.batch_events = atoi(strchr(buf, '=') + 1);
 
 			/* per connection configs */
 			else if(!strcmp(buf, "defaults {"))
@@ -505,10 +674,23 @@ static void read_one_config(char *fn, CONFIG **first, CONFIG **last, GROUPS **fi
 					cur->min_successive_pkts_rcvd   = defaults.min_successive_pkts_rcvd;
 					cur->interval_ms                = defaults.interval_ms;
 					cur->timeout_ms                 = defaults.timeout_ms;
+					cur->followed_pkts              = defaults.followed_pkts;
+					cur->max_rtt_ms                 = defaults.max_rtt_ms;
+					cur->min_rtt_ms                 = defaults.min_rtt_ms;
+					cur->rtt_percentile             = defaults.rtt_percentile;
+					cur->max_jitter_ms              = defaults.max_jitter_ms;
+					cur->min_jitter_ms              = defaults.min_jitter_ms;
+					cur->loss_window_s              = defaults.loss_window_s;
+					cur->max_loss_pct               = defaults.max_loss_pct;
+					cur->min_loss_pct               = defaults.min_loss_pct;
+					cur->max_no_reply_ms            = defaults.max_no_reply_ms;
+					cur->min_reply_run_ms           = defaults.min_reply_run_ms;
 					cur->warn_email                 = defaults.warn_email;
 					cur->check_arp                  = defaults.check_arp;
 					cur->device                     = defaults.device;
 					cur->ttl                        = defaults.ttl;
+					cur->shared_socket              = defaults.shared_socket;
+					cur->ping_socket                = defaults.ping_socket;
 					cur->status			= defaults.status;
 					cur->queue                      = defaults.queue;
 					cur->long_down_time             = defaults.long_down_time;
@@ -556,6 +738,26 @@ static void read_one_config(char *fn, CONFIG **first, CONFIG **last, GROUPS **fi
 					curg->next = NULL;
 				}
 			}
+			else if(!strcmp(buf, "queue {")) {
+				mode = 4;
+
+				if((curq = (QUEUE_CFG *)malloc(sizeof(QUEUE_CFG))) == NULL) {
+					syslog(LOG_ERR, "read_config: can't malloc for queue");
+					return;
+				}
+
+				*curq = default_queue_cfg;
+
+				/* kept in file order */
+				if(queue_cfgs) {
+					QUEUE_CFG *lastq;
+
+					for(lastq = queue_cfgs; lastq->next; lastq = lastq->next);
+					lastq->next = curq;
+				} else {
+					queue_cfgs = curq;
+				}
+			}
 			else if(!strncmp(buf, "include ", 8)) {
 				if(find_all_configs(strchr(buf, ' ') + 1, 1, first, last, firstg, lastg) != 0) {
 					syslog(LOG_ERR, "%s: %s: failed to process included config file on line %d \"%s\"", __FILE__, __FUNCTION__, line, strchr(buf, ' ') + 1);
@@ -591,8 +793,13 @@ void dump_config(CONFIG **first, CONFIG **last, GROUPS **firstg, GROUPS **lastg)
 	CONFIG *cur;
 	GROUPS *curg;
 	GROUP_MEMBERS *curgm;
+	QUEUE_CFG *curq;
 
 	syslog(LOG_INFO,   "cfg.debug                     = \"%d\"", cfg.debug);
+	syslog(LOG_INFO,   "cfg.max_pps                   = \"%d\"", cfg.max_pps);
+	syslog(LOG_INFO,   "cfg.io_uring                  = \"%d\"", cfg.io_uring);
+	syslog(LOG_INFO,   "cfg.event_decisions           = \"%d\"", cfg.event_decisions);
+	syslog(LOG_INFO,   "cfg.batch_events              = \"%d\"", cfg.batch_events);
 
 	for(cur = *first; cur; cur = cur->next) {
 		syslog(LOG_INFO, "cur->name                     = \"%s\"", cur->name);
@@ -622,12 +829,25 @@ void dump_config(CONFIG **first, CONFIG **last, GROUPS **firstg, GROUPS **lastg)
 		syslog(LOG_INFO, "cur->min_successive_pkts_rcvd = \"%d\"", cur->min_successive_pkts_rcvd);
 		syslog(LOG_INFO, "cur->interval_ms              = \"%d\"", cur->interval_ms);
 		syslog(LOG_INFO, "cur->timeout_ms               = \"%d\"", cur->timeout_ms);
+		syslog(LOG_INFO, "cur->followed_pkts            = \"%d\"", cur->followed_pkts);
+		syslog(LOG_INFO, "cur->max_rtt_ms               = \"%d\"", cur->max_rtt_ms);
+		syslog(LOG_INFO, "cur->min_rtt_ms               = \"%d\"", cur->min_rtt_ms);
+		syslog(LOG_INFO, "cur->rtt_percentile           = \"%d\"", cur->rtt_percentile);
+		syslog(LOG_INFO, "cur->max_jitter_ms            = \"%d\"", cur->max_jitter_ms);
+		syslog(LOG_INFO, "cur->min_jitter_ms            = \"%d\"", cur->min_jitter_ms);
+		syslog(LOG_INFO, "cur->loss_window_s            = \"%d\"", cur->loss_window_s);
+		syslog(LOG_INFO, "cur->max_loss_pct             = \"%d\"", cur->max_loss_pct);
+		syslog(LOG_INFO, "cur->min_loss_pct             = \"%d\"", cur->min_loss_pct);
+		syslog(LOG_INFO, "cur->max_no_reply_ms          = \"%d\"", cur->max_no_reply_ms);
+		syslog(LOG_INFO, "cur->min_reply_run_ms         = \"%d\"", cur->min_reply_run_ms);
 
 		syslog(LOG_INFO, "cur->warn_email               = \"%s\"", cur->warn_email);
 
 		syslog(LOG_INFO, "cur->check_arp                = \"%d\"", cur->check_arp);
 		syslog(LOG_INFO, "cur->device                   = \"%s\"", cur->device);
 		syslog(LOG_INFO, "cur->ttl                      = \"%d\"", cur->ttl);
+		syslog(LOG_INFO, "cur->shared_socket            = \"%d\"", cur->shared_socket);
+		syslog(LOG_INFO, "cur->ping_socket              = \"%d\"", cur->ping_socket);
 		syslog(LOG_INFO, "cur->status                   = \"%d\"", cur->status);
 		syslog(LOG_INFO, "cur->startup_acceleration     = \"%d\"", cur->startup_acceleration);
 		syslog(LOG_INFO, "cur->startup_burst_pkts       = \"%d\"", cur->startup_burst_pkts);
@@ -647,6 +867,15 @@ void dump_config(CONFIG **first, CONFIG **last, GROUPS **firstg, GROUPS **lastg)
 			syslog(LOG_INFO, "curgm->name                   = \"%s\"", curgm->name);
 		}
 	}
+
+	for(curq = queue_cfgs; curq; curq = curq->next) {
+		syslog(LOG_INFO, "curq->name                    = \"%s\"", curq->name);
+		syslog(LOG_INFO, "curq->max_running             = \"%d\"", curq->max_running);
+		syslog(LOG_INFO, "curq->deadline_ms             = \"%d\"", curq->deadline_ms);
+		syslog(LOG_INFO, "curq->kill_grace_ms           = \"%d\"", curq->kill_grace_ms);
+		syslog(LOG_INFO, "curq->max_depth               = \"%d\"", curq->max_depth);
+		syslog(LOG_INFO, "curq->drop_oldest             = \"%d\"", curq->drop_oldest);
+	}
 }
 
 static int check_addrs(CONFIG *cur)
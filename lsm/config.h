@@ -18,7 +18,8 @@ typedef enum status {
 	DOWN = 0,
 	UP = 1,
 	UNKNOWN = 2,
-	LONG_DOWN = 3
+	LONG_DOWN = 3,
+	DEGRADED = 4
 } STATUS;
 
 typedef struct config {
@@ -37,6 +38,17 @@ typedef struct config {
 	int min_successive_pkts_rcvd;
 	int interval_ms;
 	int timeout_ms;
+	int followed_pkts;
+	int max_rtt_ms;
+	int min_rtt_ms;
+	int rtt_percentile;
+	int max_jitter_ms;
+	int min_jitter_ms;
+	int loss_window_s;
+	int max_loss_pct;
+	int min_loss_pct;
+	int max_no_reply_ms;
+	int min_reply_run_ms;
 	char *warn_email;
 	int long_down_time;
 	char *long_down_email;
@@ -45,6 +57,8 @@ typedef struct config {
 	int check_arp;
 	char *device;
 	int ttl;
+	int shared_socket;
+	int ping_socket;
 	STATUS status;
 	char *queue;
 	int startup_acceleration;
@@ -75,8 +89,22 @@ typedef struct groups {
 	GROUP_MEMBERS *fgm, *lgm;
 } GROUPS;
 
+typedef struct queue_cfg {
+	char *name;
+	int max_running;	/* scripts of the queue run at once */
+	int deadline_ms;	/* SIGTERM a script running longer, 0 = no limit */
+	int kill_grace_ms;	/* SIGKILL it if still running that much later */
+	int max_depth;		/* scripts waiting to run, 0 = no limit */
+	int drop_oldest;	/* a full queue drops its oldest waiting script, else the new one */
+	struct queue_cfg *next;
+} QUEUE_CFG;
+
 typedef struct global {
 	int debug;
+	int max_pps;
+	int io_uring;
+	int event_decisions;
+	int batch_events;
 } GLOBAL;
 
 extern GLOBAL cfg;
@@ -86,6 +114,7 @@ int read_config(char *fn, CONFIG **first, CONFIG **last, GROUPS **firstg, GROUPS
 int reload_config(char *fn, CONFIG **first, CONFIG **last, GROUPS **firstg, GROUPS **lastg);
 void dump_config(CONFIG **first, CONFIG **last, GROUPS **firstg, GROUPS **lastg);
 void free_config(CONFIG **first, CONFIG **last, GROUPS **firstg, GROUPS **lastg);
+QUEUE_CFG *find_queue_config(const char *name);
 
 #endif
 
@@ -14,11 +14,23 @@ License: GPLv2
 #define FALSE	(0)
 #endif
 
-#define MIN_PERHOST_INTERVAL (20000L) /* 20ms in between sends minimum */
-#define DEFAULT_SELECT_WAIT  (10000L) /* wait at least 10ms for incoming packet */
-
-#define FOLLOWED_PKTS (100) /* THIS ABSOLUTELY CAN'T EXCEED 0xffff (65535 decimal) OR THINGS BREAK */
-#define SEQ_LIMITER   ((0x10000 / FOLLOWED_PKTS) * FOLLOWED_PKTS)
+#define MIN_PERHOST_INTERVAL (20000L) /* default startup_burst_interval */
+#define PACE_BURST_MS (50)  /* max_pps may be exceeded in bursts this long */
+#define SEND_SLACK    (5000L) /* usec a probe may go out early to join a batch */
+
+#define RECV_EVENTS  (64)   /* ready sockets handled per wakeup */
+#define RECV_BATCH   (32)   /* datagrams read with one recvmmsg() call */
+#define RECV_PKTSIZE (1500) /* receive buffer per datagram, our replies are much smaller */
+#define RECV_CTRLSIZE (512) /* ancillary data per datagram, timestamps and ipv6 options */
+#define SEND_BATCH   (64)   /* probes submitted with one sendmmsg() call */
+#define SEND_PKTSIZE (128)  /* icmp header and PING_DATA */
+#define URING_ENTRIES (256) /* io_uring submission queue size */
+#define URING_BUFS   (256)  /* provided receive buffers, a power of two */
+
+#define FOLLOWED_PKTS (100)    /* default followed_pkts */
+#define MAX_FOLLOWED_PKTS (0xffff) /* THIS ABSOLUTELY CAN'T EXCEED 0xffff (65535 decimal) OR THINGS BREAK */
+
+#define BITS_PER_LONG (8 * sizeof(unsigned long))
 
 #define min(x, y) ((x)<(y) ? (x) : (y))
 
@@ -26,7 +26,7 @@ License: GPLv2
 #include <netinet/in_systm.h>
 #include <arpa/inet.h>
 #include <netdb.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
 #include <syslog.h>
 #include <sys/wait.h>
 #include <stdarg.h>
@@ -34,7 +34,11 @@ License: GPLv2
 
 #include <sys/ioctl.h>
 #include <linux/if.h>
+#include <linux/filter.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
 #include <sys/uio.h>
+#include <poll.h>
 
 #include "icmp_t.h"
 #include "icmp6_t.h"
@@ -43,8 +47,12 @@ License: GPLv2
 #include "globals.h"
 #include "signal_handler.h"
 #include "forkexec.h"
+#include "spawn.h"
 #include "timecalc.h"
+#include "rttstat.h"
 #include "foolsm.h"
+#include "sched.h"
+#include "uring.h"
 #ifndef NO_PLUGIN_EXPORT
 #include "plugin_export.h"
 #endif
@@ -53,39 +61,186 @@ License: GPLv2
 #include "cmdline.h"
 #include "usage.h"
 
+typedef union from_addr {
+	struct sockaddr_in6 saddr6;
+	struct sockaddr_in saddr;
+	struct sockaddr_ll FROM;
+} FROM_ADDR;
+
 typedef struct ping_data {
 	unsigned short id;       /* target id */
 	long ping_count;         /* counts up to -c count or 1 */
-	struct timeval ping_ts;  /* time sent */
+	int64_t ping_ts;  /* time sent, monotonic ns */
 } PING_DATA;
 
-static void update_stats(CONFIG *first);
-static void dump_statuses(CONFIG *first);
-static void decide(CONFIG *first);
-static void groups_decide(GROUPS *firstg);
-static int wait_for_replies(CONFIG **ctable);
-static int ping_send(CONFIG *cur);
-static int ping_rcv(CONFIG *first, char *buf, int len, struct sockaddr_in6 *saddr, unsigned int *slen, long usec, CONFIG **arp);
+static void update_stats(CONFIG **ctable, int64_t now);
+static int expire_timeouts(CONFIG **ctable, int64_t now);
+static void check_timeouts(CONFIG *cur, int64_t now);
+static void slot_send(TARGET *t, int64_t now, int error);
+static void slot_reply(TARGET *t, int i, int64_t now);
+static void slot_rtt(TARGET *t, int i, long rtt);
+static int slot_seq(TARGET *t, int i);
+static void rtt_rescan(TARGET *t);
+static uint64_t run_word(HISTORY *h, int kind, int w);
+static int run_back(TARGET *t, int kind, int from);
+static size_t hist_bytes(int n);
+static void hist_carve(HISTORY *h, char *p, int n);
+static int dirty_init(int n);
+static void mark_dirty(TARGET *t);
+static void keep_dirty(TARGET *t);
+static int dirty_next(int id);
+static void dirty_rotate(void);
+static void dirty_clear(void);
+static void dump_statuses(CONFIG *first, CONFIG **ctable);
+static void dump_status(CONFIG *cur);
+static void dump_bits(char *buf, const char *title, const uint64_t *v, int n);
+static void decide(CONFIG *first, CONFIG **ctable, int64_t now);
+static int loss_verdict(CONFIG *cur, TARGET *t, int64_t now);
+static int rtt_verdict(CONFIG *cur, TARGET *t);
+static void conn_event(CONFIG *cur, char *script, char *email, STATUS prevstatus, int64_t when, int queued);
+static void groups_decide(GROUPS *firstg, int64_t now);
+static void groups_decide_dirty(CONFIG **ctable, int64_t now);
+static void group_decide(GROUPS *curg, int64_t now);
+static void group_event(GROUPS *curg, char *script, STATUS prevstatus, int64_t now, int queued);
+static int wait_for_replies(CONFIG **ctable, long usec);
+static int send_interval_ms(CONFIG *cur);
+static void schedule_next_send(CONFIG *cur, int64_t now);
+static void pace_refill(int64_t now);
+static int pace_take(void);
+static long pace_wait(void);
+static int ping_send(CONFIG *cur, int64_t now);
+static void send_flush(void);
+static void send_failed(int i, int err);
+static int snd_take(void);
+static void snd_give(int i);
+static int handle_reply(CONFIG **ctable, CONFIG *cur, char *buf, int result, FROM_ADDR *from_addr, int64_t current_time);
+static int ping_rcv(int sock, int flags);
+static int64_t rcv_stamp(struct msghdr *mhdr, int64_t fallback);
+static void handle_tx_stamp(CONFIG **ctable, char *buf, int len, struct msghdr *mhdr);
+static void enable_timestamps(int sock, int tx);
 static int event_script_check(const char *path);
+static int poll_add(int sock, void *owner);
+static void poll_del(int sock);
+static int poll_add_sock(CONFIG *cur);
+static void close_sock(TARGET *t);
 static int open_arp_sock(CONFIG *cur);
 static int open_icmp_sock(CONFIG *cur);
+static int open_shared_icmp_sock(CONFIG *cur);
+static void attach_icmp_filter(int sock, int pf);
+static int set_pktinfo(CONFIG *cur);
 static int probe_src_ip_addr(CONFIG *cur);
 static void init_config_data(CONFIG *first, CONFIG *last, CONFIG ***ctable);
 static void free_config_data(CONFIG *first);
+static void init_group_index(GROUPS *firstg);
+#ifdef HAVE_IO_URING
+static int uring_setup(void);
+static int uring_arm(int sock, int tag);
+static void uring_reap(void);
+static void uring_send_flush(void);
+static void uring_send_drain(void);
+static int uring_wait(CONFIG **ctable, long usec);
+static int uring_recv(CONFIG **ctable, CONFIG *cur, char *buf, int len, int64_t current_time);
+#endif
 #if defined(DEBUG)
 static void dump_pkt(const void *buf, size_t len);
 #endif
 
 static int num_hosts = 0;
 
+/* connection state indexed by target id, see TARGET */
+static TARGET *targets = NULL;
+static TARGET_COLD *targets_cold = NULL;
+static char *hist_pool = NULL; /* the HISTORY vectors of all targets */
+static GROUPS **group_pool = NULL; /* the group lists of all targets */
+
+/* kinds of runs counted back from the newest probe */
+#define RUN_WAITING 0
+#define RUN_MISSING 1
+#define RUN_RCVD    2
+static int epoll_fd = -1;
+
+/*
+  Connections whose counters changed since the last decision, one bit
+  per target id. Targets that must be looked at again at the next tick whether
+  or not anything happens are collected in keep_map.
+*/
+static unsigned long *dirty_map = NULL;
+static unsigned long *keep_map = NULL;
+static int dirty_words = 0;
+
+/* raw socket per protocol family for connections with shared_socket set */
+typedef struct shared_sock {
+	int sock;
+	int users;
+} SHARED_SOCK;
+
+static SHARED_SOCK shared_icmp4 = { -1, 0 };
+static SHARED_SOCK shared_icmp6 = { -1, 0 };
+
+/* preallocated receive batch shared by all sockets */
+static char rcv_bufs[RECV_BATCH][RECV_PKTSIZE];
+static FROM_ADDR rcv_from[RECV_BATCH];
+static char rcv_ctrl[RECV_BATCH][RECV_CTRLSIZE];
+static struct iovec rcv_iov[RECV_BATCH];
+static struct mmsghdr rcv_msgs[RECV_BATCH];
+
+/*
+  Send slots for icmp probes. A slot is taken when its probe is queued
+  and given back once the kernel is done with it, right after
+  sendmmsg(), or with io_uring when the send completes.
+*/
+static char snd_bufs[SEND_BATCH][SEND_PKTSIZE];
+static struct iovec snd_iov[SEND_BATCH];
+static struct mmsghdr snd_msgs[SEND_BATCH];
+static CONFIG *snd_conf[SEND_BATCH];
+static int snd_sock[SEND_BATCH];
+static int snd_slot[SEND_BATCH];
+static int snd_queue[SEND_BATCH]; /* slots queued during one scheduling pass */
+static int snd_cnt = 0;
+static int snd_free[SEND_BATCH]; /* slots given back */
+static int snd_nfree = 0;
+static int snd_used = 0; /* slots ever taken, the rest are free too */
+
+#ifdef HAVE_IO_URING
+/*
+  With io_uring every watched socket has a multishot recvmsg drawing on
+  the provided buffer ring and a multishot poll for its error queue.
+  Their completions carry the socket and its registration generation,
+  so those still in flight for a socket closed meanwhile are dropped.
+*/
+#define UR_RECV    (0)
+#define UR_ERR     (1)
+#define UR_SEND    (2)
+#define UR_CANCEL  (3)
+#define UR_BGID    (1)
+#define UR_NAMELEN ((sizeof(FROM_ADDR) + 7) & ~7)
+#define UR_BUFSIZE ((sizeof(struct io_uring_recvmsg_out) + UR_NAMELEN + RECV_CTRLSIZE + RECV_PKTSIZE + 7) & ~7)
+
+#define UR_DATA(gen, sock, tag) (((unsigned long long)(gen) << 32) | ((unsigned long long)(sock) << 3) | (tag))
+#define UR_TAG(data)  ((int)((data) & 7))
+#define UR_SOCK(data) ((int)(((data) >> 3) & 0x1fffffff))
+#define UR_GEN(data)  ((unsigned int)((data) >> 32))
+
+typedef struct uring_reg {
+	void *owner;
+	unsigned int gen;
+} URING_REG;
+
+static int use_uring = 0;
+static URING_REG *ur_regs = NULL;
+static int ur_nregs = 0;
+static struct msghdr ur_msg;
+static struct io_uring_cqe *ur_cqes = NULL;
+static int ur_ncqes = 0, ur_maxcqes = 0;
+static int ur_sends = 0;
+#endif
+
 /* Main */
 int main(int argc, char *argv[]) {
 	TARGET *t = NULL;
 	CONFIG *first = NULL, *last = NULL, *cur;
 	GROUPS *firstg = NULL, *lastg = NULL;
 	CONFIG **ctable = NULL;
-	struct timeval last_sent_time = {0, 0};
-	int start = 0;
 
 	openlog("foolsm", LOG_PID, LOG_DAEMON);
 
@@ -121,11 +276,43 @@ int main(int argc, char *argv[]) {
 
 	set_ident(getpid() & 0xFFFF);
 
+	/* fork the script spawner while the process is still small */
+	if(spawn_start()) syslog(LOG_ERR, "failed to start script spawner, retrying on the first event");
+
 #ifndef NO_PLUGIN_EXPORT
 	plugin_export_init();
 #endif
 
+	if((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		syslog(LOG_ERR, "epoll_create1 failed \"%s\"", strerror(errno));
+		exit(1);
+	}
+
+	if(cfg.io_uring) {
+#ifdef HAVE_IO_URING
+		if(uring_setup() == 0) use_uring = 1;
+		else syslog(LOG_ERR, "io_uring setup failed, using epoll");
+#else
+		syslog(LOG_ERR, "built without io_uring support, using epoll");
+#endif
+	}
+
+	{
+		int i;
+
+		memset(rcv_msgs, 0, sizeof(rcv_msgs));
+		for(i = 0; i < RECV_BATCH; i++) {
+			rcv_iov[i].iov_base = rcv_bufs[i];
+			rcv_iov[i].iov_len = RECV_PKTSIZE;
+			rcv_msgs[i].msg_hdr.msg_name = &rcv_from[i];
+			rcv_msgs[i].msg_hdr.msg_iov = &rcv_iov[i];
+			rcv_msgs[i].msg_hdr.msg_iovlen = 1;
+			rcv_msgs[i].msg_hdr.msg_control = rcv_ctrl[i];
+		}
+	}
+
 	init_config_data(first, last, &ctable);
+	init_group_index(firstg);
 
 	signal(SIGINT, signal_handler);
 	signal(SIGUSR1, signal_handler);
@@ -133,22 +320,26 @@ int main(int argc, char *argv[]) {
 	signal(SIGHUP, signal_handler);
 
 	/*
-	  Create the handler for child signals. This will clean up
-	  any forked child after an event has occured.
+	  Take child signals through a descriptor read in the main loop.
+	  This will clean up the script spawner should it exit.
 	*/
-	create_sigchld_hdl();
+	create_sigchld_fd();
 
-	struct timeval last_decision = {0, 0};
+	int64_t last_decision = 0;
 
 	/* the main loop */
 	while(get_cont()) {
-		struct timeval tv = {0, 0};
+		int64_t now, deadline, send_until;
+		int tick, lost;
 
 		if(get_reload_cfg()) {
 
 			save_statuses(first);
 
 			/* reload config */
+#ifdef HAVE_IO_URING
+			uring_send_drain();
+#endif
 			free(ctable);
 			free_config_data(first);
 			if(reload_config(get_configfile(), &first, &last, &firstg, &lastg)) {
@@ -156,30 +347,31 @@ int main(int argc, char *argv[]) {
 				exit(2);
 			}
 			init_config_data(first, last, &ctable);
+			init_group_index(firstg);
+			exec_queue_configure();
 
 			restore_statuses(first);
 
 			set_reload_cfg(0);
 		}
 
-		for(cur = first; cur; cur = cur->next) {
-			struct timeval current_time = {0, 0};
+		/* one clock read serves the whole pass */
+		if((now = nstime_now()) == 0) {
+			sleep(1);
+			continue;
+		}
 
-			if(start)
-				while(wait_for_replies(ctable));
+		/* send every probe that is due as one batch, earliest deadline first, as far as the rate cap allows */
+		pace_refill(now);
 
-			if(gettimeofday(&current_time, NULL) == -1) {
-				syslog(LOG_INFO, "gettimeofday failed \"%s\"", strerror(errno));
-				sleep(1);
-				continue;
-			}
+		send_until = now + SEND_SLACK * NSEC_PER_USEC;
 
-			t = cur->data;
+		while((t = sched_first()) != NULL) {
+			if(t->next_send > send_until) break;
 
-			if(timeval_diff_cmp(&current_time, &last_sent_time, TIMEVAL_DIFF_CMP_LT, MIN_PERHOST_INTERVAL / 1000000L, MIN_PERHOST_INTERVAL % 1000000L)) continue;
+			cur = ctable[t->id];
 
-			if(cur->startup_burst_pkts && t->used <= cur->startup_burst_pkts && !timeval_diff_cmp(&current_time, &(t->last_send_time), TIMEVAL_DIFF_CMP_LT, (cur->startup_burst_interval * 1000) / 1000000L, (cur->startup_burst_interval * 1000) % 1000000L));
-			else if(timeval_diff_cmp(&current_time, &(t->last_send_time), TIMEVAL_DIFF_CMP_LT, (cur->interval_ms * 1000) / 1000000L, (cur->interval_ms * 1000) % 1000000L)) continue;
+			if(!pace_take()) break;
 
 			if(cur->check_arp) {
 				open_arp_sock(cur);
@@ -187,43 +379,100 @@ int main(int argc, char *argv[]) {
 				open_icmp_sock(cur);
 			}
 
-			if(ping_send(cur)) {
+			if(ping_send(cur, now)) {
 				if(cfg.debug >= 9) syslog(LOG_INFO, "ping_send failed to %s", cur->name);
 			}
-			else {
-				gettimeofday(&last_sent_time, NULL);
-				start = 1;
-			}
+
+			schedule_next_send(cur, now);
 		}
 
-		gettimeofday(&tv, NULL);
-		if(timeval_diff_cmp(&tv, &last_decision, TIMEVAL_DIFF_CMP_GT, 1, 0)) { /* make decisions at 1s intervals */
-			gettimeofday(&last_decision, NULL);
+		send_flush();
+
+		/* take note of finished scripts so their queues can move on */
+		reap_children();
+		spawn_poll();
 
-			update_stats(first);
-			decide(first);
-			dump_statuses(first);
+		tick = now - last_decision > NSEC_PER_SEC;
+		lost = expire_timeouts(ctable, now);
 
-			groups_decide(firstg);
+		/*
+		  Make decisions at 1s intervals. Between the ticks decide on the
+		  connections with news, and the groups of those that changed
+		  state, as soon as a link that is not down misses a reply, or on
+		  every reply, timeout or send error with event_decisions. Only
+		  those outcomes mark a connection dirty, so a pass between the
+		  ticks never looks at unchanged connections.
+		*/
+		if(tick || lost || (cfg.event_decisions && dirty_next(0) >= 0)) {
+			if(tick) {
+				last_decision = now;
+				dirty_rotate();
+			}
+
+			update_stats(ctable, now);
+			decide(first, ctable, now);
+			dump_statuses(first, ctable);
+
+			if(tick) groups_decide(firstg, now);
+			else groups_decide_dirty(ctable, now);
+
+			dirty_clear();
+
+			exec_batch_flush();
 
 #if defined(DEBUG)
 			exec_queue_dump();
 #endif
-			exec_queue_process();
+			exec_queue_process(now);
 
 #ifndef NO_PLUGIN_EXPORT
-			plugin_export(first);
+			if(tick) plugin_export(first, now);
 #endif
 		}
+
+		/* sleep until the next probe, timeout or decision is due unless a reply arrives first */
+		deadline = last_decision + NSEC_PER_SEC + NSEC_PER_USEC;
+
+		if((t = sched_tmo_first()) != NULL && t->tmo_at < deadline) deadline = t->tmo_at;
+
+		if((t = sched_first()) != NULL) {
+			int64_t next_send;
+
+			next_send = t->next_send;
+
+			/* a probe already due was held back by the rate cap */
+			if(next_send <= now) next_send = now + pace_wait() * NSEC_PER_USEC;
+
+			if(next_send < deadline) deadline = next_send;
+		}
+
+		/* sending and deciding may have taken a while */
+		now = nstime_now();
+		wait_for_replies(ctable, deadline > now ? (long)((deadline - now + NSEC_PER_USEC - 1) / NSEC_PER_USEC) : 0);
 	} /* while cont */
 
 	/* if we wrote pid file then close and remove it */
 	pidfile_close();
 
+#ifdef HAVE_IO_URING
+	uring_send_drain();
+#endif
 	free(ctable);
 	free_config_data(first);
+	sched_free();
+	free(dirty_map);
+	free(keep_map);
 	free_config(&first, &last, &firstg, &lastg);
 	exec_queue_free();
+	spawn_stop();
+	close_sigchld_fd();
+
+	close(epoll_fd);
+#ifdef HAVE_IO_URING
+	if(use_uring) uring_free();
+	free(ur_regs);
+	free(ur_cqes);
+#endif
 
 	closelog();
 
@@ -237,78 +486,96 @@ static void free_config_data(CONFIG *first) {
 		TARGET *t;
 
 		t = cur->data;
-		if(t->sock != -1) close(t->sock);
-		free(t);
+		close_sock(t);
+		cur->data = NULL;
 	}
+
+	free(targets);
+	free(targets_cold);
+	free(hist_pool);
+	free(group_pool);
+	targets = NULL;
+	targets_cold = NULL;
+	hist_pool = NULL;
+	group_pool = NULL;
 }
 
-static void update_stats(CONFIG *first) {
-	struct timeval current_time = {0, 0};
-	CONFIG *cur;
+/* list with every connection the groups it is a member of */
+static void init_group_index(GROUPS *firstg) {
+	GROUPS *curg;
+	GROUP_MEMBERS *curgm;
+	TARGET *t;
+	int n = 0;
 
-	gettimeofday(&current_time, NULL);
+	for(curg = firstg; curg; curg = curg->next)
+		for(curgm = curg->fgm; curgm && curgm->cfg_ptr; curgm = curgm->next) n++;
 
-	for(cur = first; cur; cur = cur->next) {
-		TARGET *t;
-		int i, seq, ind;
-		long rtt = 0;
+	if((group_pool = calloc(n ? n : 1, sizeof(GROUPS *))) == NULL) {
+		syslog(LOG_ERR, "%s: %s: failed to malloc group index", __FILE__, __FUNCTION__);
+		exit(1);
+	}
 
-		t = cur->data;
+	for(curg = firstg; curg; curg = curg->next)
+		for(curgm = curg->fgm; curgm && curgm->cfg_ptr; curgm = curgm->next) ((TARGET *)curgm->cfg_ptr->data)->cold->ngroups++;
 
-		t->timeout = 0;
-		t->replied = 0;
-		t->waiting = 0;
-		t->reply_late = 0;
-		t->consecutive_waiting = 0;
-		t->consecutive_missing = 0;
-		t->consecutive_rcvd = 0;
+	n = 0;
+	for(curg = firstg; curg; curg = curg->next) {
+		for(curgm = curg->fgm; curgm && curgm->cfg_ptr; curgm = curgm->next) {
+			t = curgm->cfg_ptr->data;
 
-		/* check consecutive pkts */
-		seq = t->seq % FOLLOWED_PKTS;
+			if(!t->cold->groups) {
+				t->cold->groups = &group_pool[n];
+				n += t->cold->ngroups;
+				t->cold->ngroups = 0;
+			}
+			t->cold->groups[t->cold->ngroups++] = curg;
+		}
+	}
+}
 
-		for(i = (seq - 2); i > (seq - 2) - FOLLOWED_PKTS; i--) {
-			ind = (i >= 0) ? i : i + FOLLOWED_PKTS;
-			if(!t->sentpkts[ind].flags.used) break;
+/*
+  The replied, waiting, timeout and late counters and the rtt sum are
+  kept current as probes are sent, answered and timed out. Here only the
+  runs and averages of connections with new events are refreshed.
+*/
+static void update_stats(CONFIG **ctable, int64_t now) {
+	CONFIG *cur;
+	int id;
 
-			if(t->sentpkts[ind].flags.waiting) t->consecutive_waiting++;
-			else break;
-		}
+	for(id = dirty_next(0); id >= 0; id = dirty_next(id + 1)) {
+		TARGET *t;
+		int from;
 
-		for(i = (seq - 2); i > (seq - 2) - FOLLOWED_PKTS; i--) {
-			ind = (i >= 0) ? i : i + FOLLOWED_PKTS;
-			if(!t->sentpkts[ind].flags.used) break;
+		cur = ctable[id];
+		t = cur->data;
 
-			if(t->sentpkts[ind].flags.timeout || t->sentpkts[ind].flags.waiting) t->consecutive_missing++;
-			else break;
-		}
+		/* check consecutive pkts, the newest probe may still be on its way */
+		from = (t->seq % t->window + t->window - 2) % t->window;
 
-		for(i = (seq - 2); i > (seq - 2) - FOLLOWED_PKTS; i--) {
-			ind = (i >= 0) ? i : i + FOLLOWED_PKTS;
-			if(!t->sentpkts[ind].flags.used) break;
+		t->consecutive_waiting = run_back(t, RUN_WAITING, from);
+		t->consecutive_missing = run_back(t, RUN_MISSING, from);
+		t->consecutive_rcvd = run_back(t, RUN_RCVD, from);
 
-			if(t->sentpkts[ind].flags.replied && !t->sentpkts[ind].flags.timeout) t->consecutive_rcvd++;
-			else break;
-		}
+		/* avg_rtt in usec */
+		t->avg_rtt = t->rtt_sum / (t->replied ? t->replied : 1);
 
-		/* count pkt states */
-		for(i = 0; i < FOLLOWED_PKTS; i++) {
-			if(!t->sentpkts[i].flags.used) continue;
+		/* loss over the last loss_window_s */
+		loss_win_advance(&t->cold->loss_win, now);
+		t->loss_pct = loss_win_pct(&t->cold->loss_win);
 
-			if(timeval_diff_cmp(&current_time, &t->sentpkts[i].sent_time, TIMEVAL_DIFF_CMP_GT, (cur->timeout_ms * 1000) / 1000000L, (cur->timeout_ms * 1000) % 1000000L) && t->sentpkts[i].flags.waiting) {
-				t->sentpkts[i].flags.timeout = 1;
-			}
+		/* the rest of the rtt figures from the histogram, also in usec */
+		{
+			RTT_HIST *rh = &t->cold->rtt_hist;
 
-			if(t->sentpkts[i].flags.replied && t->sentpkts[i].flags.timeout) t->reply_late++;
+			if(rh->rescan) rtt_rescan(t);
 
-			if(t->sentpkts[i].flags.replied) {
-				t->replied++;
-				rtt += t->sentpkts[i].rtt; /* count rtt sum in usec from replied pkts rtt which is in usec */
-			}
-			if(t->sentpkts[i].flags.timeout) t->timeout++;
-			if(t->sentpkts[i].flags.waiting) t->waiting++;
+			t->cold->rtt.min = rh->n ? rh->min : 0;
+			t->cold->rtt.max = rh->n ? rh->max : 0;
+			t->cold->rtt.p50 = rtt_hist_percentile(rh, 50);
+			t->cold->rtt.p95 = rtt_hist_percentile(rh, 95);
+			t->cold->rtt.p99 = rtt_hist_percentile(rh, 99);
+			t->cold->rtt.jitter = rh->jitter >> 4;
 		}
-		/* avg_rtt in usec */
-		t->avg_rtt = rtt / (t->replied ? t->replied : 1);
 
 		/* update loss max info */
 		if(t->timeout > t->timeout_max) t->timeout_max = t->timeout;
@@ -320,87 +587,397 @@ static void update_stats(CONFIG *first) {
 	}
 }
 
-static void dump_statuses(CONFIG *first) {
-	CONFIG *cur;
+/*
+  Flag the probes whose timeout has passed, taking the connections in
+  the order their oldest unanswered probe is due. Returns how many
+  connections that are not down yet lost a probe, as those should be
+  decided on now rather than on the next tick.
+*/
+static int expire_timeouts(CONFIG **ctable, int64_t now)
+{
+	TARGET *t;
+	int lost = 0;
 
-	for(cur = first; cur; cur = cur->next) {
-		TARGET *t;
+	while((t = sched_tmo_first()) != NULL && t->tmo_at <= now) {
+		int timeout = t->timeout;
 
-		t = cur->data;
+		check_timeouts(ctable[t->id], now);
+		sched_tmo_update(t);
 
-		if((t->status == DOWN || t->status == LONG_DOWN) && t->downseq == (t->seq % FOLLOWED_PKTS) && t->seq != t->downseqreported && !t->status_change) syslog(LOG_INFO, "link %s still down", cur->name);
+		if(t->timeout > timeout && t->status != DOWN && t->status != LONG_DOWN) lost++;
+	}
 
-		/* dump is controlled by SIGUSR1 and then we should show all statuses anyway */
-		if(get_dump() || t->status_change || ((t->status == DOWN || t->status == LONG_DOWN) && t->downseq == (t->seq % FOLLOWED_PKTS) && t->seq != t->downseqreported && !t->status_change)) {
-			if(cfg.debug >= 6) syslog(LOG_INFO, "name = %s, replied = %d, waiting = %d, timeout = %d, timeout max = %d, late reply = %d, cons rcvd = %d, cons wait = %d, cons miss = %d, cons miss max = %d, avg_rtt = %.3f, seq = %d, status = %s",
-						  cur->name, t->replied, t->waiting, t->timeout, t->timeout_max, t->reply_late, t->consecutive_rcvd, t->consecutive_waiting, t->consecutive_missing, t->consecutive_missing_max, t->avg_rtt / 1000.0, t->seq, get_status_str(t->status));
+	return(lost);
+}
 
-			if(cfg.debug >= 7) {
-				/* 100 should be enough for the comments and such, but I don't care to count */
-				char buf[FOLLOWED_PKTS + 100];
-				int i, seq;
+/*
+  Probes time out in the order they were sent, so a cursor walks from
+  the oldest one not yet checked and stops at the first still in time.
+*/
+static void check_timeouts(CONFIG *cur, int64_t now)
+{
+	TARGET *t = cur->data;
+	int64_t limit = now - cur->timeout_ms * NSEC_PER_MSEC;
+	int pending = (t->seq - t->tmo_seq + t->seq_limit) % t->seq_limit;
+
+	/* slots further back have been sent again already */
+	if(pending > t->window) {
+		t->tmo_seq = (t->seq - t->window + t->seq_limit) % t->seq_limit;
+		pending = t->window;
+	}
 
-				seq = t->seq % FOLLOWED_PKTS;
+	t->tmo_at = INT64_MAX;
 
-				sprintf(buf, "seq        ");
-				for(i = 0; i < FOLLOWED_PKTS; i++) {
-					if(i == seq) strcat(buf, "*");
-					else strcat(buf, " ");
-				}
-				syslog(LOG_INFO, "%s", buf);
+	for(; pending > 0; pending--) {
+		HISTORY *h = &t->cold->hist;
+		int i = t->tmo_seq % t->window;
 
-				sprintf(buf, "used       ");
-				for(i = 0; i < FOLLOWED_PKTS; i++) {
-					sprintf(buf + strlen(buf), "%d", t->sentpkts[i].flags.used);
-				}
-				syslog(LOG_INFO, "%s", buf);
+		if(h->sent_time[i] >= limit) {
+			t->tmo_at = h->sent_time[i] + cur->timeout_ms * NSEC_PER_MSEC;
+			break;
+		}
 
-				sprintf(buf, "wait       ");
-				for(i = 0; i < FOLLOWED_PKTS; i++) {
-					sprintf(buf + strlen(buf), "%d", t->sentpkts[i].flags.waiting);
-				}
-				syslog(LOG_INFO, "%s", buf);
+		if(BIT_TEST(h->waiting, i) && !BIT_TEST(h->timeout, i)) {
+			BIT_SET(h->timeout, i);
+			t->timeout++;
+			t->replying_since = 0;
+			loss_win_add(&t->cold->loss_win, h->sent_time[i], 1, now);
+			mark_dirty(t);
+		}
 
-				sprintf(buf, "replied    ");
-				for(i = 0; i < FOLLOWED_PKTS; i++) {
-					sprintf(buf + strlen(buf), "%d", t->sentpkts[i].flags.replied);
-				}
-				syslog(LOG_INFO, "%s", buf);
+		t->tmo_seq = (t->tmo_seq + 1) % t->seq_limit;
+	}
+}
 
-				sprintf(buf, "timeout    ");
-				for(i = 0; i < FOLLOWED_PKTS; i++) {
-					sprintf(buf + strlen(buf), "%d", t->sentpkts[i].flags.timeout);
-				}
-				syslog(LOG_INFO, "%s", buf);
+/* take the slot of t->seq for a new probe, dropping what it counted for before */
+static void slot_send(TARGET *t, int64_t now, int error)
+{
+	HISTORY *h = &t->cold->hist;
+	int i = t->seq % t->window;
+
+	if(BIT_TEST(h->used, i)) {
+		if(BIT_TEST(h->replied, i)) {
+			t->replied--;
+			t->rtt_sum -= h->rtt[i];
+			rtt_hist_del(&t->cold->rtt_hist, h->rtt[i]);
+			if(BIT_TEST(h->timeout, i)) t->reply_late--;
+		}
+		if(BIT_TEST(h->timeout, i)) t->timeout--;
+		if(BIT_TEST(h->waiting, i)) t->waiting--;
+	} else
+		t->used++;
+
+	h->sent_time[i] = now;
+	h->rtt[i] = 0;
+	BIT_CLR(h->replied, i);
+	BIT_CLR(h->timeout, i);
+	BIT_SET(h->waiting, i);
+	BIT_SET(h->used, i);
+	if(error) BIT_SET(h->error, i);
+	else BIT_CLR(h->error, i);
+	t->waiting++;
+
+	if(!t->silent_since) t->silent_since = now;
+
+	/* the next timeout pass finds out exactly when this one is due */
+	if(t->tmo_at == INT64_MAX) {
+		t->tmo_at = now;
+		sched_tmo_update(t);
+	}
 
-				sprintf(buf, "error      ");
-				for(i = 0; i < FOLLOWED_PKTS; i++) {
-					sprintf(buf + strlen(buf), "%d", t->sentpkts[i].flags.error);
-				}
-				syslog(LOG_INFO, "%s", buf);
+	t->seq = (t->seq + 1) % t->seq_limit; /* limit seq so that consecutive missing and received pkt counting doesn't get confused when seq "overflows" */
+	t->num_sent++;
 
-				if(t->status == UP && t->status_change) {
-					t->timeout_max = 0;
-					t->consecutive_missing_max = 0;
-				}
-			}
+	/* a send is no news, its reply, timeout or error is */
+	if(error) mark_dirty(t);
+}
+
+static void slot_reply(TARGET *t, int i, int64_t now)
+{
+	HISTORY *h = &t->cold->hist;
+	int first;
+
+	if(!BIT_TEST(h->used, i)) return;
+
+	if((first = !BIT_TEST(h->replied, i))) {
+		t->replied++;
+		if(BIT_TEST(h->timeout, i)) t->reply_late++;
+		else {
+			if(!t->replying_since) t->replying_since = now;
+			loss_win_add(&t->cold->loss_win, h->sent_time[i], 0, now);
+		}
+		t->silent_since = 0;
+	}
+	if(BIT_TEST(h->waiting, i)) t->waiting--;
+
+	BIT_CLR(h->waiting, i);
+	slot_rtt(t, i, (now - h->sent_time[i]) / NSEC_PER_USEC);
+	BIT_SET(h->replied, i);
+
+	/* a repeated reply says nothing new about the spacing of replies */
+	if(first) rtt_hist_jitter(&t->cold->rtt_hist, h->rtt[i]);
+}
+
+/* set the rtt of slot i, replacing the one it counted with if it was replied already */
+static void slot_rtt(TARGET *t, int i, long rtt)
+{
+	HISTORY *h = &t->cold->hist;
+	RTT_HIST *rh = &t->cold->rtt_hist;
+
+	if(rtt < 0) rtt = 0;
+	if(rtt > UINT32_MAX) rtt = UINT32_MAX;
+
+	if(BIT_TEST(h->replied, i)) {
+		t->rtt_sum -= h->rtt[i];
+		rtt_hist_del(rh, h->rtt[i]);
+	}
+
+	h->rtt[i] = rtt;
+	t->rtt_sum += rtt;
+	rtt_hist_add(rh, rtt);
+
+	mark_dirty(t);
+}
+
+/* find the rtt min and max again after one of them left the window */
+static void rtt_rescan(TARGET *t)
+{
+	HISTORY *h = &t->cold->hist;
+	RTT_HIST *rh = &t->cold->rtt_hist;
+	int w;
+
+	rh->min = UINT32_MAX;
+	rh->max = 0;
+
+	for(w = 0; w < HIST_WORDS(t->window); w++) {
+		uint64_t v = h->used[w] & h->replied[w];
 
-			t->downseqreported = t->seq;
+		while(v) {
+			uint32_t rtt = h->rtt[w * 64 + __builtin_ctzll(v)];
+
+			if(rtt < rh->min) rh->min = rtt;
+			if(rtt > rh->max) rh->max = rtt;
+			v &= v - 1;
 		}
 	}
-	if(get_dump()) set_dump(0); /* if we just dumped then don't dump next time. flags don't change that frequently */
+
+	rh->rescan = 0;
+}
+
+/* the seq of the probe slot i was last used for */
+static int slot_seq(TARGET *t, int i)
+{
+	int last = (t->seq + t->seq_limit - 1) % t->seq_limit;
+
+	return((last - (last % t->window - i + t->window) % t->window + t->seq_limit) % t->seq_limit);
+}
+
+/* word w of the slots that count towards a run of the given kind, an unused slot ends every run */
+static uint64_t run_word(HISTORY *h, int kind, int w)
+{
+	switch(kind) {
+	case RUN_WAITING:
+		return(h->used[w] & h->waiting[w]);
+	case RUN_MISSING:
+		return(h->used[w] & (h->timeout[w] | h->waiting[w]));
+	default:
+		return(h->used[w] & h->replied[w] & ~h->timeout[w]);
+	}
+}
+
+/*
+  Length of the run of slots of the given kind that ends at slot from,
+  counted towards lower slots and wrapping around the window.
+*/
+static int run_back(TARGET *t, int kind, int from)
+{
+	HISTORY *h = &t->cold->hist;
+	int n = 0, pos = from;
+
+	while(n < t->window) {
+		int b = pos % 64;
+		uint64_t x = ~(run_word(h, kind, pos / 64) << (63 - b));
+		int ones = x ? __builtin_clzll(x) : 64;
+
+		if(ones > b + 1) ones = b + 1;
+		n += ones;
+		if(ones < b + 1) break;
+
+		pos = (pos - ones + t->window) % t->window;
+	}
+
+	return(n < t->window ? n : t->window);
+}
+
+/* storage needed for the history of a window of n pkts */
+static size_t hist_bytes(int n)
+{
+	return(5 * HIST_WORDS(n) * sizeof(uint64_t) + n * sizeof(int64_t) + ((n * sizeof(uint32_t) + 7) & ~7UL));
+}
+
+/* point the vectors of h into hist_bytes(n) of zeroed storage at p */
+static void hist_carve(HISTORY *h, char *p, int n)
+{
+	int words = HIST_WORDS(n);
+
+	h->used = (uint64_t *)p;
+	h->replied = h->used + words;
+	h->waiting = h->replied + words;
+	h->timeout = h->waiting + words;
+	h->error = h->timeout + words;
+	h->sent_time = (int64_t *)(h->error + words);
+	h->rtt = (uint32_t *)(h->sent_time + n);
+}
+
+static int dirty_init(int n)
+{
+	dirty_words = (n + BITS_PER_LONG - 1) / BITS_PER_LONG;
+
+	free(dirty_map);
+	free(keep_map);
+
+	dirty_map = calloc(dirty_words ? dirty_words : 1, sizeof(unsigned long));
+	keep_map = calloc(dirty_words ? dirty_words : 1, sizeof(unsigned long));
+	if(dirty_map == NULL || keep_map == NULL) {
+		syslog(LOG_ERR, "%s: %s: failed to malloc dirty set", __FILE__, __FUNCTION__);
+		return(1);
+	}
+
+	/* everything is new at startup and after a reload */
+	memset(dirty_map, 0xff, dirty_words * sizeof(unsigned long));
+	if(n % BITS_PER_LONG) dirty_map[dirty_words - 1] = (1UL << (n % BITS_PER_LONG)) - 1;
+
+	return(0);
+}
+
+static void mark_dirty(TARGET *t)
+{
+	dirty_map[t->id / BITS_PER_LONG] |= 1UL << (t->id % BITS_PER_LONG);
+}
+
+static void keep_dirty(TARGET *t)
+{
+	keep_map[t->id / BITS_PER_LONG] |= 1UL << (t->id % BITS_PER_LONG);
+}
+
+/* first dirty target id not below id, -1 when there is none */
+static int dirty_next(int id)
+{
+	int w = id / BITS_PER_LONG;
+	unsigned long bits;
+
+	if(w >= dirty_words) return(-1);
+
+	bits = dirty_map[w] & (~0UL << (id % BITS_PER_LONG));
+
+	while(!bits) {
+		if(++w >= dirty_words) return(-1);
+		bits = dirty_map[w];
+	}
+
+	return(w * BITS_PER_LONG + __builtin_ctzl(bits));
+}
+
+/* a tick also looks at what the last one asked to be looked at again */
+static void dirty_rotate(void)
+{
+	int w;
+
+	for(w = 0; w < dirty_words; w++) dirty_map[w] |= keep_map[w];
+	memset(keep_map, 0, dirty_words * sizeof(unsigned long));
+}
+
+/* a decision is done, what has to be looked at again waits in keep_map for the next tick */
+static void dirty_clear(void)
+{
+	memset(dirty_map, 0, dirty_words * sizeof(unsigned long));
 }
 
-static void decide(CONFIG *first) {
-	struct timeval current_time = {0, 0};
+static void dump_statuses(CONFIG *first, CONFIG **ctable) {
 	CONFIG *cur;
+	int id;
+
+	/* dump is controlled by SIGUSR1 and then we should show all statuses anyway */
+	if(get_dump()) {
+		for(cur = first; cur; cur = cur->next) dump_status(cur);
+		exec_queue_stats();
+		set_dump(0); /* if we just dumped then don't dump next time. flags don't change that frequently */
+		return;
+	}
+
+	/* nothing to report for connections without news */
+	for(id = dirty_next(0); id >= 0; id = dirty_next(id + 1)) dump_status(ctable[id]);
+}
 
-	gettimeofday(&current_time, NULL);
+static void dump_status(CONFIG *cur) {
+	TARGET *t = cur->data;
 
-	for(cur = first; cur; cur = cur->next) {
+	if((t->status == DOWN || t->status == LONG_DOWN) && t->downseq == (t->seq % t->window) && t->seq != t->downseqreported && !t->status_change) syslog(LOG_INFO, "link %s still down", cur->name);
+
+	/* dump is controlled by SIGUSR1 and then we should show all statuses anyway */
+	if(get_dump() || t->status_change || ((t->status == DOWN || t->status == LONG_DOWN) && t->downseq == (t->seq % t->window) && t->seq != t->downseqreported && !t->status_change)) {
+		if(cfg.debug >= 6) syslog(LOG_INFO, "name = %s, replied = %d, waiting = %d, timeout = %d, timeout max = %d, late reply = %d, cons rcvd = %d, cons wait = %d, cons miss = %d, cons miss max = %d, avg_rtt = %.3f, rtt min/p50/p95/p99/max = %.3f/%.3f/%.3f/%.3f/%.3f, jitter = %.3f, seq = %d, status = %s",
+					  cur->name, t->replied, t->waiting, t->timeout, t->timeout_max, t->reply_late, t->consecutive_rcvd, t->consecutive_waiting, t->consecutive_missing, t->consecutive_missing_max, t->avg_rtt / 1000.0,
+					  t->cold->rtt.min / 1000.0, t->cold->rtt.p50 / 1000.0, t->cold->rtt.p95 / 1000.0, t->cold->rtt.p99 / 1000.0, t->cold->rtt.max / 1000.0, t->cold->rtt.jitter / 1000.0, t->seq, get_status_str(t->status));
+
+		if(cfg.debug >= 7) {
+			/* 100 should be enough for the comments and such, but I don't care to count */
+			char *buf;
+			int i, seq;
+
+			if((buf = malloc(t->window + 100)) == NULL) {
+				syslog(LOG_ERR, "%s: %s: failed to malloc dump buffer", __FILE__, __FUNCTION__);
+				return;
+			}
+
+			seq = t->seq % t->window;
+
+			sprintf(buf, "seq        ");
+			for(i = 0; i < t->window; i++) buf[11 + i] = (i == seq) ? '*' : ' ';
+			buf[11 + i] = '\0';
+			syslog(LOG_INFO, "%s", buf);
+
+			dump_bits(buf, "used       ", t->cold->hist.used, t->window);
+			dump_bits(buf, "wait       ", t->cold->hist.waiting, t->window);
+			dump_bits(buf, "replied    ", t->cold->hist.replied, t->window);
+			dump_bits(buf, "timeout    ", t->cold->hist.timeout, t->window);
+			dump_bits(buf, "error      ", t->cold->hist.error, t->window);
+
+			free(buf);
+
+			if(t->status == UP && t->status_change) {
+				t->timeout_max = 0;
+				t->consecutive_missing_max = 0;
+			}
+		}
+
+		t->downseqreported = t->seq;
+	}
+}
+
+/* log one history vector of n slots after an 11 character title */
+static void dump_bits(char *buf, const char *title, const uint64_t *v, int n)
+{
+	int i;
+
+	memcpy(buf, title, 11);
+	for(i = 0; i < n; i++) buf[11 + i] = '0' + BIT_TEST(v, i);
+	buf[11 + i] = '\0';
+
+	syslog(LOG_INFO, "%s", buf);
+}
+
+static void decide(CONFIG *first, CONFIG **ctable, int64_t now) {
+	CONFIG *cur;
+	int id;
+
+	/* only connections with new events can change state */
+	for(id = dirty_next(0); id >= 0; id = dirty_next(id + 1)) {
 		TARGET *t;
 		STATUS prevstatus;
+		int verdict;
 
+		cur = ctable[id];
 		t = cur->data;
 
 		/* reset any previous connection status_change state */
@@ -408,9 +985,9 @@ static void decide(CONFIG *first) {
 
 		prevstatus = t->status;
 
-		/* up or unknown */
-		if(t->status == UP || t->status == UNKNOWN) {
-			if(t->timeout >= cur->max_packet_loss || t->consecutive_missing >= cur->max_successive_pkts_lost) {
+		/* up, degraded or unknown */
+		if(t->status == UP || t->status == DEGRADED || t->status == UNKNOWN) {
+			if(loss_verdict(cur, t, now) > 0) {
 				/* change to down state */
 				t->status_change = 1;
 				t->status = DOWN;
@@ -420,164 +997,52 @@ static void decide(CONFIG *first) {
 #endif
 
 				if(cfg.debug >= 8) syslog(LOG_INFO, "link %s down event", cur->name);
-				if(event_script_check(cur->eventscript)) {
-					char sbuf[INET6_ADDRSTRLEN];
-					char **argv;
-					char **envp;
-
-					argv = exec_queue_argv("%s %s %s %s %s %s %d %d %d %d %d %d %d %d %s %s %d",
-							       cur->eventscript,
-							       get_status_str(t->status),
-							       cur->name,
-							       cur->checkip,
-							       cur->device ? cur->device : "",
-							       cur->warn_email ? cur->warn_email : "",
-							       t->replied,
-							       t->waiting,
-							       t->timeout,
-							       t->reply_late,
-							       t->consecutive_rcvd,
-							       t->consecutive_waiting,
-							       t->consecutive_missing,
-							       t->avg_rtt,
-							       cur->dstinfo->ai_family == AF_INET ? inet_ntoa(t->src) : inet_ntop(AF_INET6, &t->src6, sbuf, INET6_ADDRSTRLEN),
-							       get_status_str(prevstatus),
-							       current_time.tv_sec);
-					envp = exec_queue_envp();
-
-					if(cur->queue && *cur->queue) {
-						exec_queue_add(cur->queue, argv, envp);
-					} else {
-						forkexec(argv, envp);
-
-						exec_queue_argv_free(argv);
-						exec_queue_envp_free(envp);
-					}
-				}
-
-				if(event_script_check(cur->notifyscript)) {
-					char sbuf[INET6_ADDRSTRLEN];
-					char **argv;
-					char **envp;
-
-					argv = exec_queue_argv("%s %s %s %s %s %s %d %d %d %d %d %d %d %d %s %s %d",
-							       cur->notifyscript,
-							       get_status_str(t->status),
-							       cur->name,
-							       cur->checkip,
-							       cur->device ? cur->device : "",
-							       cur->warn_email ? cur->warn_email : "",
-							       t->replied,
-							       t->waiting,
-							       t->timeout,
-							       t->reply_late,
-							       t->consecutive_rcvd,
-							       t->consecutive_waiting,
-							       t->consecutive_missing,
-							       t->avg_rtt,
-							       cur->dstinfo->ai_family == AF_INET ? inet_ntoa(t->src) : inet_ntop(AF_INET6, &t->src6, sbuf, INET6_ADDRSTRLEN),
-							       get_status_str(prevstatus),
-							       current_time.tv_sec);
-
-					envp = exec_queue_envp();
-
-					forkexec(argv, envp);
-
-					exec_queue_argv_free(argv);
-					exec_queue_envp_free(envp);
-				}
+				conn_event(cur, cur->eventscript, cur->warn_email, prevstatus, now, 1);
+				conn_event(cur, cur->notifyscript, cur->warn_email, prevstatus, now, 0);
 
-				if(gettimeofday(&t->down_timestamp, NULL) == -1) {
-					syslog(LOG_INFO, "gettimeofday failed \"%s\"", strerror(errno));
-				}
-				t->downseq = t->seq % FOLLOWED_PKTS;
+				t->down_timestamp = now;
+				t->downseq = t->seq % t->window;
 				t->downseqreported = 0;
 			}
 		}
 
+		/* up or degraded, judged by latency alone */
+		if(t->status == UP || t->status == DEGRADED) {
+			verdict = rtt_verdict(cur, t);
+
+			if((t->status == UP && verdict > 0) || (t->status == DEGRADED && verdict == 0)) {
+				t->status_change = 1;
+				t->status = t->status == UP ? DEGRADED : UP;
+
+#if !defined(NO_PLUGIN_EXPORT) && !defined(NO_PLUGIN_EXPORT_STATUS)
+				plugin_export_status(first);
+#endif
+
+				if(cfg.debug >= 8) syslog(LOG_INFO, "link %s %s event", cur->name, t->status == UP ? "up" : "degraded");
+				conn_event(cur, cur->eventscript, cur->warn_email, prevstatus, now, 1);
+				conn_event(cur, cur->notifyscript, cur->warn_email, prevstatus, now, 0);
+			}
+		}
+
 		/* has it been down long? */
 		if(t->status == DOWN && cur->long_down_time) {
-			if(timeval_diff_cmp(&current_time, &t->down_timestamp, TIMEVAL_DIFF_CMP_GT, cur->long_down_time, 0)) {
+			if(now - t->down_timestamp > cur->long_down_time * NSEC_PER_SEC) {
 				/* special, LONG_DOWN is considered DOWN thus no status_change */
 				t->status = LONG_DOWN;
 
 				if(cfg.debug >= 8) syslog(LOG_INFO, "link %s long down event", cur->name);
-				if(event_script_check(cur->long_down_eventscript)) {
-					char sbuf[INET6_ADDRSTRLEN];
-					char **argv;
-					char **envp;
-
-					argv = exec_queue_argv("%s %s %s %s %s %s %d %d %d %d %d %d %d %d %s %s %d",
-							       cur->long_down_eventscript,
-							       get_status_str(t->status),
-							       cur->name,
-							       cur->checkip,
-							       cur->device ? cur->device : "",
-							       cur->long_down_email ? cur->long_down_email : "",
-							       t->replied,
-							       t->waiting,
-							       t->timeout,
-							       t->reply_late,
-							       t->consecutive_rcvd,
-							       t->consecutive_waiting,
-							       t->consecutive_missing,
-							       t->avg_rtt,
-							       cur->dstinfo->ai_family == AF_INET ? inet_ntoa(t->src) : inet_ntop(AF_INET6, &t->src6, sbuf, INET6_ADDRSTRLEN),
-							       get_status_str(prevstatus),
-							       t->down_timestamp.tv_sec);
-
-					envp = exec_queue_envp();
-
-					if(cur->queue && *cur->queue) {
-						exec_queue_add(cur->queue, argv, envp);
-					} else {
-						forkexec(argv, envp);
-
-						exec_queue_argv_free(argv);
-						exec_queue_envp_free(envp);
-					}
-				}
-
-				if(event_script_check(cur->long_down_notifyscript)) {
-					char sbuf[INET6_ADDRSTRLEN];
-					char **argv;
-					char **envp;
-
-					argv = exec_queue_argv("%s %s %s %s %s %s %d %d %d %d %d %d %d %d %s %s %d",
-							       cur->long_down_notifyscript,
-							       get_status_str(t->status),
-							       cur->name,
-							       cur->checkip,
-							       cur->device ? cur->device : "",
-							       cur->long_down_email ? cur->long_down_email : "",
-							       t->replied,
-							       t->waiting,
-							       t->timeout,
-							       t->reply_late,
-							       t->consecutive_rcvd,
-							       t->consecutive_waiting,
-							       t->consecutive_missing,
-							       t->avg_rtt,
-							       cur->dstinfo->ai_family == AF_INET ? inet_ntoa(t->src) : inet_ntop(AF_INET6, &t->src6, sbuf, INET6_ADDRSTRLEN),
-							       get_status_str(prevstatus),
-							       t->down_timestamp.tv_sec);
-
-					envp = exec_queue_envp();
-
-					forkexec(argv, envp);
-
-					exec_queue_argv_free(argv);
-					exec_queue_envp_free(envp);
-				}
+				conn_event(cur, cur->long_down_eventscript, cur->long_down_email, prevstatus, t->down_timestamp, 1);
+				conn_event(cur, cur->long_down_notifyscript, cur->long_down_email, prevstatus, t->down_timestamp, 0);
 			}
 		}
 
 		/* down, long down or unknown */
 		if(t->status == DOWN || t->status == LONG_DOWN || t->status == UNKNOWN) {
-			if((cur->startup_acceleration && t->consecutive_rcvd >= cur->startup_acceleration && (t->consecutive_rcvd + 1) >= t->used) || (t->timeout <= cur->min_packet_loss && t->consecutive_rcvd >= cur->min_successive_pkts_rcvd)) {
+			if((cur->startup_acceleration && t->consecutive_rcvd >= cur->startup_acceleration && (t->consecutive_rcvd + 1) >= t->used) || loss_verdict(cur, t, now) == 0) {
 
+				/* a link that comes back slow comes back degraded */
 				t->status_change = 1;
-				t->status = UP;
+				t->status = rtt_verdict(cur, t) > 0 ? DEGRADED : UP;
 
 #if !defined(NO_PLUGIN_EXPORT) && !defined(NO_PLUGIN_EXPORT_STATUS)
 				plugin_export_status(first);
@@ -585,356 +1050,330 @@ static void decide(CONFIG *first) {
 
 				/* report long_down to up */
 				if(prevstatus == LONG_DOWN) {
-					if(event_script_check(cur->long_down_eventscript)) {
-						char sbuf[INET6_ADDRSTRLEN];
-						char **argv;
-						char **envp;
-
-						argv = exec_queue_argv("%s %s %s %s %s %s %d %d %d %d %d %d %d %d %s %s %d",
-								       cur->long_down_eventscript,
-								       get_status_str(t->status),
-								       cur->name,
-								       cur->checkip,
-								       cur->device ? cur->device : "",
-								       cur->long_down_email ? cur->long_down_email : "",
-								       t->replied,
-								       t->waiting,
-								       t->timeout,
-								       t->reply_late,
-								       t->consecutive_rcvd,
-								       t->consecutive_waiting,
-								       t->consecutive_missing,
-								       t->avg_rtt,
-								       cur->dstinfo->ai_family == AF_INET ? inet_ntoa(t->src) : inet_ntop(AF_INET6, &t->src6, sbuf, INET6_ADDRSTRLEN),
-								       get_status_str(prevstatus),
-								       current_time.tv_sec);
-
-						envp = exec_queue_envp();
-
-						if(cur->queue && *cur->queue) {
-							exec_queue_add(cur->queue, argv, envp);
-						} else {
-							forkexec(argv, envp);
-
-							exec_queue_argv_free(argv);
-							exec_queue_envp_free(envp);
-						}
-					}
-
-					if(event_script_check(cur->long_down_notifyscript)) {
-						char sbuf[INET6_ADDRSTRLEN];
-						char **argv;
-						char **envp;
-
-						argv = exec_queue_argv("%s %s %s %s %s %s %d %d %d %d %d %d %d %d %s %s %d",
-								       cur->long_down_notifyscript,
-								       get_status_str(t->status),
-								       cur->name,
-								       cur->checkip,
-								       cur->device ? cur->device : "",
-								       cur->long_down_email ? cur->long_down_email : "",
-								       t->replied,
-								       t->waiting,
-								       t->timeout,
-								       t->reply_late,
-								       t->consecutive_rcvd,
-								       t->consecutive_waiting,
-								       t->consecutive_missing,
-								       t->avg_rtt,
-								       cur->dstinfo->ai_family == AF_INET ? inet_ntoa(t->src) : inet_ntop(AF_INET6, &t->src6, sbuf, INET6_ADDRSTRLEN),
-								       get_status_str(prevstatus),
-								       current_time.tv_sec);
-
-						envp = exec_queue_envp();
-
-						forkexec(argv, envp);
-
-						exec_queue_argv_free(argv);
-						exec_queue_envp_free(envp);
-					}
+					conn_event(cur, cur->long_down_eventscript, cur->long_down_email, prevstatus, now, 1);
+					conn_event(cur, cur->long_down_notifyscript, cur->long_down_email, prevstatus, now, 0);
 				}
 
 				/* change to up state */
-				if(cfg.debug >= 8) syslog(LOG_INFO, "link %s up event", cur->name);
-				if(event_script_check(cur->eventscript)) {
-					char sbuf[INET6_ADDRSTRLEN];
-					char **argv;
-					char **envp;
-
-					argv = exec_queue_argv("%s %s %s %s %s %s %d %d %d %d %d %d %d %d %s %s %d",
-							       cur->eventscript,
-							       get_status_str(t->status),
-							       cur->name,
-							       cur->checkip,
-							       cur->device ? cur->device : "",
-							       cur->warn_email ? cur->warn_email : "",
-							       t->replied,
-							       t->waiting,
-							       t->timeout,
-							       t->reply_late,
-							       t->consecutive_rcvd,
-							       t->consecutive_waiting,
-							       t->consecutive_missing,
-							       t->avg_rtt,
-							       cur->dstinfo->ai_family == AF_INET ? inet_ntoa(t->src) : inet_ntop(AF_INET6, &t->src6, sbuf, INET6_ADDRSTRLEN),
-							       get_status_str(prevstatus),
-							       current_time.tv_sec);
-
-					envp = exec_queue_envp();
-
-					if(cur->queue && *cur->queue) {
-						exec_queue_add(cur->queue, argv, envp);
-					} else {
-						forkexec(argv, envp);
-
-						exec_queue_argv_free(argv);
-						exec_queue_envp_free(envp);
-					}
-				}
-
-				if((cur->unknown_up_notify || t->status != UNKNOWN) && event_script_check(cur->notifyscript)) {
-					char sbuf[INET6_ADDRSTRLEN];
-					char **argv;
-					char **envp;
-
-					argv = exec_queue_argv("%s %s %s %s %s %s %d %d %d %d %d %d %d %d %s %s %d",
-							       cur->notifyscript,
-							       get_status_str(t->status),
-							       cur->name,
-							       cur->checkip,
-							       cur->device ? cur->device : "",
-							       cur->warn_email ? cur->warn_email : "",
-							       t->replied,
-							       t->waiting,
-							       t->timeout,
-							       t->reply_late,
-							       t->consecutive_rcvd,
-							       t->consecutive_waiting,
-							       t->consecutive_missing,
-							       t->avg_rtt,
-							       cur->dstinfo->ai_family == AF_INET ? inet_ntoa(t->src) : inet_ntop(AF_INET6, &t->src6, sbuf, INET6_ADDRSTRLEN),
-							       get_status_str(prevstatus),
-							       current_time.tv_sec);
-
-					envp = exec_queue_envp();
-
-					forkexec(argv, envp);
-
-					exec_queue_argv_free(argv);
-					exec_queue_envp_free(envp);
-				}
+				if(cfg.debug >= 8) syslog(LOG_INFO, "link %s %s event", cur->name, get_status_str(t->status));
+				conn_event(cur, cur->eventscript, cur->warn_email, prevstatus, now, 1);
+				if(cur->unknown_up_notify || t->status != UNKNOWN) conn_event(cur, cur->notifyscript, cur->warn_email, prevstatus, now, 0);
 			}
 		}
+
+		/* a status change is reset and a pending long down checked next time round */
+		if(t->status_change || (t->status == DOWN && cur->long_down_time)) keep_dirty(t);
 	}
 }
 
-static void groups_decide(GROUPS *firstg){
-	GROUPS *curg;
-	GROUP_MEMBERS *curgm;
-	TARGET *t;
-	STATUS prevstatus;
-	struct timeval current_time = {0, 0};
+/*
+  Loss verdict on a connection: 1 when it has lost too much or gone
+  without a reply for too long, 0 when it may come up, -1 in between.
+  With loss_window_s, max_no_reply_ms or min_reply_run_ms set, the
+  matching probe counted threshold is replaced by one over time.
+*/
+static int loss_verdict(CONFIG *cur, TARGET *t, int64_t now)
+{
+	int down = 0, up = 1;
 
-	gettimeofday(&current_time, NULL);
+	if(cur->loss_window_s) {
+		if(loss_win_above(&t->cold->loss_win, cur->max_loss_pct)) down = 1;
+		if(loss_win_above(&t->cold->loss_win, cur->min_loss_pct)) up = 0;
+	} else {
+		if(t->timeout >= cur->max_packet_loss) down = 1;
+		if(t->timeout > cur->min_packet_loss) up = 0;
+	}
 
-	curg = firstg;
-	while(curg) {
-		prevstatus = curg->status;
-		curg->status = curg->logic;
+	if(cur->max_no_reply_ms) {
+		if(t->silent_since && now - t->silent_since >= cur->max_no_reply_ms * NSEC_PER_MSEC) down = 1;
+	} else {
+		if(t->consecutive_missing >= cur->max_successive_pkts_lost) down = 1;
+	}
 
-		curgm = curg->fgm;
-		while(curgm) {
-			if(!curgm->cfg_ptr) break;
+	if(cur->min_reply_run_ms) {
+		if(!t->replying_since || now - t->replying_since < cur->min_reply_run_ms * NSEC_PER_MSEC) up = 0;
+	} else {
+		if(t->consecutive_rcvd < cur->min_successive_pkts_rcvd) up = 0;
+	}
 
-			t = curgm->cfg_ptr->data;
+	return(down ? 1 : up ? 0 : -1);
+}
 
-			/* if any one group member is in unknown status, group is in unknown status */
-			if(t->status == UNKNOWN) {
-				curg->status = UNKNOWN;
-				break;
-			}
+/*
+  Latency verdict on a connection: 1 when the chosen rtt percentile or
+  the jitter is above its max, 0 when all checked figures are at or
+  below their min, -1 in between, where the status is left as it is.
+*/
+static int rtt_verdict(CONFIG *cur, TARGET *t)
+{
+	int over = 0, under = 1;
 
-			if(!curg->logic) {
-				curg->status |= (t->status == DOWN || t->status == LONG_DOWN) ? DOWN : t->status;
-			} else {
-				curg->status &= (t->status == DOWN || t->status == LONG_DOWN) ? DOWN : t->status;
-			}
+	if(cur->max_rtt_ms) {
+		uint32_t rtt = cur->rtt_percentile == 50 ? t->cold->rtt.p50 : cur->rtt_percentile == 99 ? t->cold->rtt.p99 : t->cold->rtt.p95;
 
-			curgm = curgm->next;
-		}
-		if(curg->status != prevstatus) {
-			if(curg->status == UP) {
-				/* group up event */
-				if(cfg.debug >= 8) syslog(LOG_INFO, "group %s up event", curg->name);
-				if(event_script_check(curg->eventscript)) {
-					char **argv;
-					char **envp;
-
-					argv = exec_queue_argv("%s %s %s %s %s %s %d %d %d %d %d %d %d %d %s %s %d",
-							       curg->eventscript,
-							       get_status_str(curg->status),
-							       curg->name,
-							       "",
-							       curg->device ? curg->device : "",
-							       curg->warn_email ? curg->warn_email : "",
-							       0,
-							       0,
-							       0,
-							       0,
-							       0,
-							       0,
-							       0,
-							       0,
-							       "",
-							       get_status_str(prevstatus),
-							       current_time.tv_sec);
-					envp = exec_queue_envp();
-
-					if(curg->queue && *curg->queue) {
-						exec_queue_add(curg->queue, argv, envp);
-					} else {
-						forkexec(argv, envp);
-
-						exec_queue_argv_free(argv);
-						exec_queue_envp_free(envp);
-					}
+		if(rtt > (uint32_t)cur->max_rtt_ms * 1000) over = 1;
+		if(rtt > (uint32_t)cur->min_rtt_ms * 1000) under = 0;
+	}
+
+	if(cur->max_jitter_ms) {
+		if(t->cold->rtt.jitter > (uint32_t)cur->max_jitter_ms * 1000) over = 1;
+		if(t->cold->rtt.jitter > (uint32_t)cur->min_jitter_ms * 1000) under = 0;
+	}
+
+	return(over ? 1 : under ? 0 : -1);
+}
+
+/* run an event or notify script of a connection with its current figures */
+static void conn_event(CONFIG *cur, char *script, char *email, STATUS prevstatus, int64_t when, int queued)
+{
+	TARGET *t = cur->data;
+	char sbuf[INET6_ADDRSTRLEN];
+	char **argv;
+	char **envp;
+
+	if(!event_script_check(script)) return;
+
+	argv = exec_queue_argv("%s %s %s %s %s %s %d %d %d %d %d %d %d %d %s %s %d %u %u %u %u %u %u",
+			       script,
+			       get_status_str(t->status),
+			       cur->name,
+			       cur->checkip,
+			       cur->device ? cur->device : "",
+			       email ? email : "",
+			       t->replied,
+			       t->waiting,
+			       t->timeout,
+			       t->reply_late,
+			       t->consecutive_rcvd,
+			       t->consecutive_waiting,
+			       t->consecutive_missing,
+			       t->avg_rtt,
+			       cur->dstinfo->ai_family == AF_INET ? inet_ntoa(t->cold->src) : inet_ntop(AF_INET6, &t->cold->src6, sbuf, INET6_ADDRSTRLEN),
+			       get_status_str(prevstatus),
+			       nstime_wall(when),
+			       t->cold->rtt.p50,
+			       t->cold->rtt.p95,
+			       t->cold->rtt.p99,
+			       t->cold->rtt.min,
+			       t->cold->rtt.max,
+			       t->cold->rtt.jitter);
+
+	/* eventscript runs of one decision pass go out together */
+	if(queued && cfg.batch_events) {
+		exec_batch_add(cur->queue, argv);
+		return;
+	}
+
+	envp = exec_queue_envp();
+
+	if(queued && cur->queue && *cur->queue) {
+		exec_queue_add(cur->queue, argv, envp);
+	} else {
+		forkexec(argv, envp);
+
+		exec_queue_argv_free(argv);
+	}
+}
+
+static void groups_decide(GROUPS *firstg, int64_t now){
+	GROUPS *curg;
+
+	for(curg = firstg; curg; curg = curg->next) group_decide(curg, now);
+}
+
+/* only the groups of connections that changed state can change state */
+static void groups_decide_dirty(CONFIG **ctable, int64_t now){
+	int id, i;
+
+	for(id = dirty_next(0); id >= 0; id = dirty_next(id + 1)) {
+		TARGET *t = ctable[id]->data;
+
+		if(!t->status_change) continue;
+
+		for(i = 0; i < t->cold->ngroups; i++) group_decide(t->cold->groups[i], now);
+	}
+}
+
+/*
+  A degraded member still carries traffic, so it counts as up for the
+  availability of the group, but an or group with no member fully up
+  and an and group with any member degraded are degraded themselves.
+*/
+static void group_decide(GROUPS *curg, int64_t now){
+	GROUP_MEMBERS *curgm;
+	TARGET *t;
+	STATUS prevstatus;
+	int up = 0, degraded = 0, down = 0;
+
+	prevstatus = curg->status;
+
+	for(curgm = curg->fgm; curgm; curgm = curgm->next) {
+		if(!curgm->cfg_ptr) break;
+
+		t = curgm->cfg_ptr->data;
+
+		/* if any one group member is in unknown status, group is in unknown status */
+		if(t->status == UNKNOWN) break;
+
+		if(t->status == UP) up++;
+		else if(t->status == DEGRADED) degraded++;
+		else down++;
+	}
+
+	if(curgm && curgm->cfg_ptr) {
+		curg->status = UNKNOWN;
+	} else if(!curg->logic) {
+		curg->status = up ? UP : degraded ? DEGRADED : DOWN;
+	} else {
+		curg->status = down ? DOWN : degraded ? DEGRADED : UP;
+	}
+
+	if(curg->status != prevstatus && curg->status != UNKNOWN) {
+		/* group up, degraded or down event */
+		if(cfg.debug >= 8) syslog(LOG_INFO, "group %s %s event", curg->name, get_status_str(curg->status));
+		group_event(curg, curg->eventscript, prevstatus, now, 1);
+		if(curg->status != UP || curg->unknown_up_notify || prevstatus != UNKNOWN) group_event(curg, curg->notifyscript, prevstatus, now, 0);
+	}
+}
+
+/* run an event or notify script of a group, which has no figures of its own */
+static void group_event(GROUPS *curg, char *script, STATUS prevstatus, int64_t now, int queued)
+{
+	char **argv;
+	char **envp;
+
+	if(!event_script_check(script)) return;
+
+	argv = exec_queue_argv("%s %s %s %s %s %s %d %d %d %d %d %d %d %d %s %s %d %u %u %u %u %u %u",
+			       script,
+			       get_status_str(curg->status),
+			       curg->name,
+			       "",
+			       curg->device ? curg->device : "",
+			       curg->warn_email ? curg->warn_email : "",
+			       0,
+			       0,
+			       0,
+			       0,
+			       0,
+			       0,
+			       0,
+			       0,
+			       "",
+			       get_status_str(prevstatus),
+			       nstime_wall(now),
+			       0,
+			       0,
+			       0,
+			       0,
+			       0,
+			       0);
+	if(queued && cfg.batch_events) {
+		exec_batch_add(curg->queue, argv);
+		return;
+	}
+
+	envp = exec_queue_envp();
+
+	if(queued && curg->queue && *curg->queue) {
+		exec_queue_add(curg->queue, argv, envp);
+	} else {
+		forkexec(argv, envp);
+
+		exec_queue_argv_free(argv);
+	}
+}
+
+static int wait_for_replies(CONFIG **ctable, long usec) {
+	struct epoll_event evs[RECV_EVENTS];
+	int64_t current_time;
+	int nfound, i, n, cnt = 0;
+
+#if defined(DEBUG)
+	printf("timeout = %ld ms\n", (usec + 999) / 1000);
+#endif
+
+#ifdef HAVE_IO_URING
+	if(use_uring) return(uring_wait(ctable, usec));
+#endif
+
+	/* each registered socket carries its owning connection so there is no need to scan the list */
+	nfound = epoll_wait(epoll_fd, evs, RECV_EVENTS, (usec + 999) / 1000);
+
+	if(nfound < 0) {
+		if(errno != EINTR) syslog(LOG_INFO, "epoll_wait failed \"%s\"", strerror(errno));
+		return(0);
+	}
+
+	if(nfound == 0) return(0);
+
+	current_time = nstime_now();
+
+	/* drain every ready socket before going back to sleep */
+	for(i = 0; i < nfound; i++) {
+		CONFIG *cur = NULL;
+		int sock;
+
+		/* shared sockets carry no connection, replies are matched by id */
+		if(evs[i].data.ptr == &shared_icmp4 || evs[i].data.ptr == &shared_icmp6) {
+			sock = ((SHARED_SOCK *)evs[i].data.ptr)->sock;
+		} else {
+			cur = evs[i].data.ptr;
+			sock = ((TARGET *)cur->data)->sock;
+		}
+
+		/* transmit timestamps are looped back through the error queue */
+		if(evs[i].events & EPOLLERR) {
+			do {
+				int j;
+
+				if((n = ping_rcv(sock, MSG_ERRQUEUE)) < 0) break;
+
+				for(j = 0; j < n; j++) {
+					handle_tx_stamp(ctable, rcv_bufs[j], rcv_msgs[j].msg_len, &rcv_msgs[j].msg_hdr);
 				}
-				if((curg->unknown_up_notify || prevstatus != UNKNOWN) && event_script_check(curg->notifyscript)) {
-					char **argv;
-					char **envp;
-
-					argv = exec_queue_argv("%s %s %s %s %s %s %d %d %d %d %d %d %d %d %s %s %d",
-							       curg->notifyscript,
-							       get_status_str(curg->status),
-							       curg->name,
-							       "",
-							       curg->device ? curg->device : "",
-							       curg->warn_email ? curg->warn_email : "",
-							       0,
-							       0,
-							       0,
-							       0,
-							       0,
-							       0,
-							       0,
-							       0,
-							       "",
-							       get_status_str(prevstatus),
-							       current_time.tv_sec);
-					envp = exec_queue_envp();
-
-					forkexec(argv, envp);
-
-					exec_queue_argv_free(argv);
-					exec_queue_envp_free(envp);
+			} while(n == RECV_BATCH);
+		}
+
+		do {
+			int j;
+
+			if((n = ping_rcv(sock, 0)) < 0) {
+				if(cur) {
+					if(cfg.debug >= 9) syslog(LOG_INFO, "recvmmsg failed with connection %s \"%s\"", cur->name, strerror(errno));
+					close_sock(cur->data);
+				} else {
+					if(cfg.debug >= 9) syslog(LOG_INFO, "recvmmsg failed on shared socket \"%s\"", strerror(errno));
 				}
+				break;
 			}
 
-			if(curg->status == DOWN) {
-				/* group down event */
-				if(cfg.debug >= 8) syslog(LOG_INFO, "group %s down event", curg->name);
-				if(event_script_check(curg->eventscript)) {
-					char **argv;
-					char **envp;
-
-					argv = exec_queue_argv("%s %s %s %s %s %s %d %d %d %d %d %d %d %d %s %s %d",
-							       curg->eventscript,
-							       get_status_str(curg->status),
-							       curg->name,
-							       "",
-							       curg->device ? curg->device : "",
-							       curg->warn_email ? curg->warn_email : "",
-							       0,
-							       0,
-							       0,
-							       0,
-							       0,
-							       0,
-							       0,
-							       0,
-							       "",
-							       get_status_str(prevstatus),
-							       current_time.tv_sec);
-					envp = exec_queue_envp();
-
-					if(curg->queue && *curg->queue) {
-						exec_queue_add(curg->queue, argv, envp);
-					} else {
-						forkexec(argv, envp);
-
-						exec_queue_argv_free(argv);
-						exec_queue_envp_free(envp);
-					}
-				}
-				if(event_script_check(curg->notifyscript)) {
-					char **argv;
-					char **envp;
-
-					argv = exec_queue_argv("%s %s %s %s %s %s %d %d %d %d %d %d %d %d %s %s %d",
-							       curg->notifyscript,
-							       get_status_str(curg->status),
-							       curg->name,
-							       "",
-							       curg->device ? curg->device : "",
-							       curg->warn_email ? curg->warn_email : "",
-							       0,
-							       0,
-							       0,
-							       0,
-							       0,
-							       0,
-							       0,
-							       0,
-							       "",
-							       get_status_str(prevstatus),
-							       current_time.tv_sec);
-					envp = exec_queue_envp();
-
-					forkexec(argv, envp);
-
-					exec_queue_argv_free(argv);
-					exec_queue_envp_free(envp);
-				}
+			for(j = 0; j < n; j++) {
+				handle_reply(ctable, cur, rcv_bufs[j], rcv_msgs[j].msg_len, &rcv_from[j], rcv_stamp(&rcv_msgs[j].msg_hdr, current_time));
 			}
-		}
-		curg = curg->next;
+			cnt += n;
+		} while(n == RECV_BATCH);
 	}
+
+	return(cnt);
 }
 
-static int wait_for_replies(CONFIG **ctable) {
+static int handle_reply(CONFIG **ctable, CONFIG *cur, char *buf, int result, FROM_ADDR *from_addr, int64_t current_time) {
 	struct ip *ip;
 	int hlen = 0;
 	struct icmp *icp;
 	struct icmp6_hdr *icp6;
 	PING_DATA *pdp;
 	int this_count;
-	struct timeval sent_time = {0, 0};
-	struct timeval current_time = {0, 0};
+	int64_t sent_time;
 	long time_diff;
-	char buf[BUFSIZ];
-	union {
-		struct sockaddr_in6 saddr6;
-		struct sockaddr_in saddr;
-		struct sockaddr_ll FROM;
-	} from_addr;
-	unsigned int slen;
-	int result;
 	TARGET *t;
 	int seq;
-	CONFIG *arp;
-
-	slen = sizeof(from_addr);
-	result = ping_rcv(ctable[0], buf, BUFSIZ, (struct sockaddr_in6 *)&from_addr, &slen, DEFAULT_SELECT_WAIT, &arp);
+	int ping = (cur && cur->ping_socket);
 
-	if(result <= 0) {
-		return(0);
-	}
-
-	gettimeofday(&current_time, NULL);
-
-	if(arp) {
-		struct sockaddr_ll *FROM = &from_addr.FROM;
-		TARGET *t = arp->data;
+	if(cur && cur->check_arp) {
+		struct sockaddr_ll *FROM = &from_addr->FROM;
+		TARGET *t = cur->data;
 		struct arphdr *ah = (struct arphdr*)buf;
 		unsigned char *p = (unsigned char *)(ah+1);
 		struct in_addr src_ip, dst_ip;
@@ -966,7 +1405,7 @@ static int wait_for_replies(CONFIG **ctable) {
 			return(1);
 		if(ah->ar_pln != 4)
 			return(1);
-		if(ah->ar_hln != t->me.sll_halen)
+		if(ah->ar_hln != t->cold->me.sll_halen)
 			return(1);
 
 #if defined(DEBUG)
@@ -990,20 +1429,17 @@ static int wait_for_replies(CONFIG **ctable) {
 		memcpy(&src_ip, p+ah->ar_hln, 4);
 		memcpy(&dst_ip, p+ah->ar_hln+4+ah->ar_hln, 4);
 
-		if(src_ip.s_addr != t->dst.s_addr)
+		if(src_ip.s_addr != t->cold->dst.s_addr)
 			return(1);
-		if(t->src.s_addr != dst_ip.s_addr)
+		if(t->cold->src.s_addr != dst_ip.s_addr)
 			return(1);
-		if(memcmp(p+ah->ar_hln+4, &t->me.sll_addr, ah->ar_hln))
+		if(memcmp(p+ah->ar_hln+4, &t->cold->me.sll_addr, ah->ar_hln))
 			return(1);
 
 		/* update packet log here */
 		/* there are no sequence numbers in arp replies so just mark seq - 1 replied */
-		ind = ((t->seq - 1) >= 0 ? (t->seq - 1) : (FOLLOWED_PKTS + (t->seq - 1))) % FOLLOWED_PKTS;
-		t->sentpkts[ind].flags.replied = 1;
-		t->sentpkts[ind].flags.waiting = 0;
-		t->sentpkts[ind].replied_time = current_time;
-		t->sentpkts[ind].rtt = timeval_diff(&current_time, &t->sentpkts[ind].sent_time);
+		ind = ((t->seq - 1) >= 0 ? (t->seq - 1) : (t->seq_limit + (t->seq - 1))) % t->window;
+		slot_reply(t, ind, current_time);
 
 		return(1);
 	}
@@ -1012,17 +1448,20 @@ static int wait_for_replies(CONFIG **ctable) {
 	if(cfg.debug >= 9) {
 		char sbuf[INET6_ADDRSTRLEN];
 
-		syslog(LOG_INFO, "not arp: family = %d, AF_INET = %d, AF_INET6 = %d, inet_ntop addr = %s, inet_ntoa addr = %s", from_addr.saddr6.sin6_family, AF_INET, AF_INET6, inet_ntop(from_addr.saddr6.sin6_family, &from_addr.saddr6.sin6_addr, sbuf, INET6_ADDRSTRLEN), inet_ntoa(from_addr.saddr.sin_addr));
+		syslog(LOG_INFO, "not arp: family = %d, AF_INET = %d, AF_INET6 = %d, inet_ntop addr = %s, inet_ntoa addr = %s", from_addr->saddr6.sin6_family, AF_INET, AF_INET6, inet_ntop(from_addr->saddr6.sin6_family, &from_addr->saddr6.sin6_addr, sbuf, INET6_ADDRSTRLEN), inet_ntoa(from_addr->saddr.sin_addr));
 	}
 #endif
 
-	switch(from_addr.saddr6.sin6_family) {
+	switch(from_addr->saddr6.sin6_family) {
 	case AF_INET:
 #if defined(DEBUG)
 		syslog(LOG_INFO, "%s: %s: AF_INET reply", __FILE__, __FUNCTION__);
 #endif
-		ip = (struct ip *)buf;
-		hlen = ip->ip_hl << 2;
+		/* ping sockets deliver the icmp message without the ip header */
+		if(!ping) {
+			ip = (struct ip *)buf;
+			hlen = ip->ip_hl << 2;
+		}
 
 		icp = (struct icmp *)(buf + hlen);
 
@@ -1031,12 +1470,12 @@ static int wait_for_replies(CONFIG **ctable) {
 		}
 
 		if(icp->icmp_type == ICMP_ECHOREPLY) {
-			if(icp->icmp_id != get_ident()) {
+			if(!ping && icp->icmp_id != get_ident()) {
 				/* fprintf(stderr, "icmp_id = %d funny, got reply from %s to something else ...\n", icp->icmp_id, inet_ntoa(saddr.sin_addr)); */
 				return(1);
 			}
 
-			if(result < sizeof(struct icmp) + sizeof(PING_DATA)) {
+			if(result < hlen + sizeof(struct icmp) + sizeof(PING_DATA)) {
 				/* fprintf(stderr, "too short ping reply\n"); */
 				return(1);
 			}
@@ -1045,34 +1484,36 @@ static int wait_for_replies(CONFIG **ctable) {
 
 			this_count = pdp->ping_count;
 			sent_time = pdp->ping_ts;
-			time_diff = timeval_diff(&current_time, &sent_time);
+			time_diff = (current_time - sent_time) / NSEC_PER_USEC;
 
 			if(pdp->id >= num_hosts) {
 #if defined(DEBUG)
-				syslog(LOG_INFO, "out of range: pdp->id = %d >= num_hosts = %d from %s", pdp->id, num_hosts, inet_ntoa(from_addr.saddr.sin_addr));
+				syslog(LOG_INFO, "out of range: pdp->id = %d >= num_hosts = %d from %s", pdp->id, num_hosts, inet_ntoa(from_addr->saddr.sin_addr));
 				dump_pkt(buf, sizeof(struct ip) + sizeof(struct icmp) + sizeof(PING_DATA));
 				set_dump(1);
 #endif
 				return(1);
 			}
 
+			/* the kernel has already matched a ping socket reply to its connection */
+			if(ping && ctable[pdp->id] != cur) {
+				return(1);
+			}
+
 			t = ctable[pdp->id]->data;
 
-			if(memcmp(&ip->ip_src, &t->dst, sizeof(struct in_addr) != 0)) {
+			if(memcmp(&from_addr->saddr.sin_addr, &t->cold->dst, sizeof(struct in_addr)) != 0) {
 				return(1);
 			}
 
-			seq = icp->icmp_seq % FOLLOWED_PKTS;
-			if(t->sentpkts[seq].seq == icp->icmp_seq) {
-				t->sentpkts[seq].flags.replied = 1;
-				t->sentpkts[seq].flags.waiting = 0;
-				t->sentpkts[seq].replied_time = current_time;
-				t->sentpkts[seq].rtt = timeval_diff(&current_time, &t->sentpkts[seq].sent_time);
+			seq = icp->icmp_seq % t->window;
+			if(slot_seq(t, seq) == icp->icmp_seq) {
+				slot_reply(t, seq, current_time);
 			}
 			else
-				if(cfg.debug >= 9) syslog(LOG_INFO, "sentpkts seq != icmp_seq");
+				if(cfg.debug >= 9) syslog(LOG_INFO, "history seq != icmp_seq");
 
-			if(cfg.debug >= 9) syslog(LOG_INFO, "received seq = %d from %s, id = %d, num_sent = %d, target id = %u, time_diff = %ld", icp->icmp_seq, inet_ntoa(from_addr.saddr.sin_addr), icp->icmp_id, this_count, pdp->id, time_diff);
+			if(cfg.debug >= 9) syslog(LOG_INFO, "received seq = %d from %s, id = %d, num_sent = %d, target id = %u, time_diff = %ld", icp->icmp_seq, inet_ntoa(from_addr->saddr.sin_addr), icp->icmp_id, this_count, pdp->id, time_diff);
 
 			return(1);
 
@@ -1081,7 +1522,7 @@ static int wait_for_replies(CONFIG **ctable) {
 
 			msg = stricmp(icp->icmp_type, icp->icmp_code);
 
-			if(cfg.debug >= 9) syslog(LOG_INFO, "got odd reply from %s, icmp_type = %d %s, icmp_code = %d %s", inet_ntoa(from_addr.saddr.sin_addr), icp->icmp_type, msg->type_msg, icp->icmp_code, msg->code_msg);
+			if(cfg.debug >= 9) syslog(LOG_INFO, "got odd reply from %s, icmp_type = %d %s, icmp_code = %d %s", inet_ntoa(from_addr->saddr.sin_addr), icp->icmp_type, msg->type_msg, icp->icmp_code, msg->code_msg);
 
 			return(1);
 		}
@@ -1103,7 +1544,7 @@ static int wait_for_replies(CONFIG **ctable) {
 #endif
 			/* syslog(LOG_INFO, "sizeof struct icmp6_hdr = %ld\n", sizeof(struct icmp6_hdr)); */
 
-			if(icp6->icmp6_id != get_ident()) {
+			if(!ping && icp6->icmp6_id != get_ident()) {
 				return(1);
 			}
 
@@ -1117,38 +1558,39 @@ static int wait_for_replies(CONFIG **ctable) {
 
 			this_count = pdp->ping_count;
 			sent_time = pdp->ping_ts;
-			time_diff = timeval_diff(&current_time, &sent_time);
+			time_diff = (current_time - sent_time) / NSEC_PER_USEC;
 
 #if defined(DEBUG)
-			syslog(LOG_INFO, "%s: %s: this_count = %d, sent_time = %ld,%ld, pdp->id = %d", __FILE__, __FUNCTION__, this_count, sent_time.tv_sec, sent_time.tv_usec, pdp->id);
+			syslog(LOG_INFO, "%s: %s: this_count = %d, sent_time = %lld, pdp->id = %d", __FILE__, __FUNCTION__, this_count, (long long)sent_time, pdp->id);
 #endif
 
 			if(pdp->id >= num_hosts) {
 #if defined(DEBUG)
-				syslog(LOG_INFO, "out of range: pdp->id = %d >= num_hosts = %d from %s", pdp->id, num_hosts, inet_ntop(AF_INET6, &from_addr.saddr6.sin6_addr, sbuf, INET6_ADDRSTRLEN));
+				syslog(LOG_INFO, "out of range: pdp->id = %d >= num_hosts = %d from %s", pdp->id, num_hosts, inet_ntop(AF_INET6, &from_addr->saddr6.sin6_addr, sbuf, INET6_ADDRSTRLEN));
 				dump_pkt(buf, sizeof(struct icmp6_hdr) + sizeof(PING_DATA));
 				set_dump(1);
 #endif
 				return(1);
 			}
 
+			if(ping && ctable[pdp->id] != cur) {
+				return(1);
+			}
+
 			t = ctable[pdp->id]->data;
 
-			if(memcmp(&from_addr.saddr6.sin6_addr, &t->dst6, sizeof(struct in6_addr)) != 0) {
+			if(memcmp(&from_addr->saddr6.sin6_addr, &t->cold->dst6, sizeof(struct in6_addr)) != 0) {
 				return(1);
 			}
 
-			seq = ntohs(icp6->icmp6_seq) % FOLLOWED_PKTS;
-			if(t->sentpkts[seq].seq == ntohs(icp6->icmp6_seq)) {
-				t->sentpkts[seq].flags.replied = 1;
-				t->sentpkts[seq].flags.waiting = 0;
-				t->sentpkts[seq].replied_time = current_time;
-				t->sentpkts[seq].rtt = timeval_diff(&current_time, &t->sentpkts[seq].sent_time);
+			seq = ntohs(icp6->icmp6_seq) % t->window;
+			if(slot_seq(t, seq) == ntohs(icp6->icmp6_seq)) {
+				slot_reply(t, seq, current_time);
 			}
 			else
-				if (cfg.debug >= 9) syslog(LOG_INFO, "sentpkts seq != icmp_seq");
+				if (cfg.debug >= 9) syslog(LOG_INFO, "history seq != icmp_seq");
 
-			if(cfg.debug >= 9) syslog(LOG_INFO, "received seq = %d from %s, id = %d, num_sent = %d, target id = %u, time_diff = %ld", ntohs(icp6->icmp6_seq), inet_ntop(AF_INET6, &from_addr.saddr6.sin6_addr, sbuf, INET6_ADDRSTRLEN), icp6->icmp6_id, this_count, pdp->id, time_diff);
+			if(cfg.debug >= 9) syslog(LOG_INFO, "received seq = %d from %s, id = %d, num_sent = %d, target id = %u, time_diff = %ld", ntohs(icp6->icmp6_seq), inet_ntop(AF_INET6, &from_addr->saddr6.sin6_addr, sbuf, INET6_ADDRSTRLEN), icp6->icmp6_id, this_count, pdp->id, time_diff);
 
 			return(1);
 		} else {
@@ -1157,7 +1599,7 @@ static int wait_for_replies(CONFIG **ctable) {
 
 			msg = stricmp6(icp6->icmp6_type, icp6->icmp6_code);
 
-			if(cfg.debug >= 9) syslog(LOG_INFO, "got odd reply from %s, icmp_type = %d %s, icmp_code = %d %s", inet_ntop(from_addr.saddr6.sin6_family, &from_addr.saddr6.sin6_addr, sbuf, INET6_ADDRSTRLEN), icp6->icmp6_type, msg->type_msg, icp6->icmp6_code, msg->code_msg);
+			if(cfg.debug >= 9) syslog(LOG_INFO, "got odd reply from %s, icmp_type = %d %s, icmp_code = %d %s", inet_ntop(from_addr->saddr6.sin6_family, &from_addr->saddr6.sin6_addr, sbuf, INET6_ADDRSTRLEN), icp6->icmp6_type, msg->type_msg, icp6->icmp6_code, msg->code_msg);
 
 			return(1);
 		}
@@ -1170,85 +1612,189 @@ static int wait_for_replies(CONFIG **ctable) {
 	return(1);
 }
 
-static int ping_rcv(CONFIG *first, char *buf, int len, struct sockaddr_in6 *saddr, unsigned int *slen, long usec, CONFIG **arp) {
-	int nfound, n;
-	fd_set readset;
-	struct timeval to = {0, 0};
-	int max;
-	CONFIG *cur;
-	TARGET *t;
-	int cnt_targets = 0;
+/*
+  Read as many pending datagrams from the socket as fit in the
+  preallocated receive batch. Returns the number of datagrams read or
+  -1 if the socket failed.
+*/
+static int ping_rcv(int sock, int flags) {
+	int i, n;
 
-	FD_ZERO(&readset);
-	max = 0;
+	if(sock == -1) return(0);
 
-	for(cur = first; cur; cur = cur->next) {
-		t = cur->data;
-		if(t->sock == -1) continue;
-		if(t->sock > max) max = t->sock;
-		FD_SET(t->sock, &readset);
-		cnt_targets++;
+	for(i = 0; i < RECV_BATCH; i++) {
+		rcv_msgs[i].msg_hdr.msg_namelen = sizeof(rcv_from[i]);
+		rcv_msgs[i].msg_hdr.msg_controllen = RECV_CTRLSIZE;
 	}
 
-	/* no point in calling select if we didn't find any open sockets. so sleep and return ... */
-	if(cnt_targets == 0) {
-		sleep(1);
-		return(0);
+	n = recvmmsg(sock, rcv_msgs, RECV_BATCH, MSG_DONTWAIT | flags, NULL);
+
+	if(n < 0) {
+		if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return(0);
+		return(-1);
 	}
 
-	to.tv_sec = usec / 1000000;
-	to.tv_usec = (usec - (to.tv_sec * 1000000));
+	return(n);
+}
 
-#if defined(DEBUG)
-	printf("to.tv_sec = %ld, to.tv_usec = %ld\n", to.tv_sec, to.tv_usec);
-#endif
+/*
+  Kernel receive timestamp of a datagram, or the time the loop woke up
+  if the socket did not provide one. A stamp from after the wakeup can
+  only come from a wall clock step and is not trusted.
+*/
+static int64_t rcv_stamp(struct msghdr *mhdr, int64_t fallback)
+{
+	struct cmsghdr *cmsg;
 
-	nfound = select(max + 1, &readset, NULL, NULL, &to);
+	for(cmsg = CMSG_FIRSTHDR(mhdr); cmsg; cmsg = CMSG_NXTHDR(mhdr, cmsg)) {
+		if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			struct timespec ts;
+			int64_t stamp;
 
-	if(nfound < 0) {
-		if(errno != EINTR) syslog(LOG_INFO, "select failed \"%s\"", strerror(errno));
-		return(0);
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+			stamp = nstime_from_real(&ts);
+			return(stamp <= fallback ? stamp : fallback);
+		}
 	}
 
-	if(nfound == 0) return(-1);
+	return(fallback);
+}
 
-	for(cur = first; cur; cur = cur->next) {
-		t = cur->data;
-		if(t->sock == -1) continue;
-		if(FD_ISSET(t->sock, &readset)) {
-			if(!cur->check_arp) {
-				*arp = (CONFIG *)NULL;
-			} else {
-				*arp = cur;
-			}
+/*
+  A software transmit timestamp carries a copy of the sent frame. Our
+  PING_DATA is at its very end, which identifies the probe whatever the
+  link and network headers in front of it. The probe must still be in
+  its history slot with the send time we put into it.
+*/
+static void handle_tx_stamp(CONFIG **ctable, char *buf, int len, struct msghdr *mhdr)
+{
+	struct cmsghdr *cmsg;
+	struct scm_timestamping *tss = NULL;
+	struct sock_extended_err *serr = NULL;
+	PING_DATA pd;
+	HISTORY *h;
+	TARGET *t;
+	int64_t tx;
+	int seq, i;
+
+	for(cmsg = CMSG_FIRSTHDR(mhdr); cmsg; cmsg = CMSG_NXTHDR(mhdr, cmsg)) {
+		if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING)
+			tss = (struct scm_timestamping *)CMSG_DATA(cmsg);
+		else if((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+			(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+			serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+	}
 
-			n = recvfrom(t->sock, buf, len, 0, (struct sockaddr *)saddr, slen);
+	if(!tss || !serr) return;
+	if(serr->ee_origin != SO_EE_ORIGIN_TIMESTAMPING || serr->ee_info != SCM_TSTAMP_SND) return;
+	if(len < (int)sizeof(PING_DATA)) return;
 
-			if(n < 0) {
-				if(cfg.debug >= 9) syslog(LOG_INFO, "recvfrom failed with connection %s \"%s\", n = %d, errno = %d", cur->name, strerror(errno), n, errno);
-				close(t->sock);
-				t->sock = -1;
-				return(0);
-			}
+	memcpy(&pd, buf + len - sizeof(PING_DATA), sizeof(PING_DATA));
 
-			return(n);
-		}
-	}
-	return(0);
+	if(pd.id >= num_hosts) return;
+
+	t = ctable[pd.id]->data;
+	h = &t->cold->hist;
+	seq = pd.ping_count % t->seq_limit;
+	i = seq % t->window;
+
+	if(!BIT_TEST(h->used, i) || slot_seq(t, i) != seq || h->sent_time[i] != pd.ping_ts) return;
+
+	/* the probe cannot have left before it was built */
+	tx = nstime_from_real(&tss->ts[0]);
+	if(tx < h->sent_time[i]) return;
+
+	/* the reply may have been handled before the timestamp */
+	if(BIT_TEST(h->replied, i)) slot_rtt(t, i, h->rtt[i] - (tx - h->sent_time[i]) / NSEC_PER_USEC);
+
+	h->sent_time[i] = tx;
+}
+
+
+static int send_interval_ms(CONFIG *cur)
+{
+	TARGET *t = cur->data;
+
+	/* startup burst probes go out at the faster of the two intervals */
+	if(cur->startup_burst_pkts && t->used <= cur->startup_burst_pkts && cur->startup_burst_interval < cur->interval_ms)
+		return(cur->startup_burst_interval);
+
+	return(cur->interval_ms);
+}
+
+/*
+  Advance the deadline by one interval from the previous deadline, not
+  from the actual send time, so each connection keeps its phase. A
+  connection that fell more than an interval behind starts over from now.
+*/
+static void schedule_next_send(CONFIG *cur, int64_t now)
+{
+	TARGET *t = cur->data;
+
+	t->next_send += send_interval_ms(cur) * NSEC_PER_MSEC;
+	if(t->next_send < now) t->next_send = now;
+
+	sched_update(cur);
+}
+
+/*
+  Optional global send rate cap (max_pps). The bucket holds up to
+  PACE_BURST_MS worth of probes and is kept in millionths of a probe.
+  A connection held back keeps its deadline in the scheduler, so the
+  longest waiting one goes first when the rate allows again.
+*/
+static long long pace_tokens = 0;
+static int64_t pace_last = 0;
+
+static void pace_refill(int64_t now)
+{
+	long long max;
+	long elapsed;
+
+	if(cfg.max_pps <= 0) return;
+
+	max = (long long)cfg.max_pps * PACE_BURST_MS * 1000LL;
+	if(max < 1000000LL) max = 1000000LL;
+
+	elapsed = (now - pace_last) / NSEC_PER_USEC;
+	pace_last = now;
+
+	if(elapsed <= 0) return;
+	if(elapsed > 1000000L) elapsed = 1000000L;
+
+	pace_tokens += (long long)elapsed * cfg.max_pps;
+	if(pace_tokens > max) pace_tokens = max;
 }
 
-static int ping_send(CONFIG *cur) {
-	char buf[BUFSIZ];
+static int pace_take(void)
+{
+	if(cfg.max_pps <= 0) return(1);
+
+	if(pace_tokens < 1000000LL) return(0);
+
+	pace_tokens -= 1000000LL;
+	return(1);
+}
+
+/* microseconds until the next probe may be sent */
+static long pace_wait(void)
+{
+	if(cfg.max_pps <= 0 || pace_tokens >= 1000000LL) return(0);
+
+	return((long)((1000000LL - pace_tokens + cfg.max_pps - 1) / cfg.max_pps));
+}
+
+static int ping_send(CONFIG *cur, int64_t now) {
+	char *buf;
 	struct icmp *icp;
+	struct msghdr *mhdr;
 	PING_DATA *pdp;
 	TARGET *t;
-	int n;
+	int seq, i;
 	int ping_pkt_size;
 
 	t = cur->data;
 
-	gettimeofday(&t->last_send_time, NULL);
-
 	if(cur->check_arp) {
 		int err;
 		unsigned char buf[256];
@@ -1260,24 +1806,24 @@ static int ping_send(CONFIG *cur) {
 			return(-1);
 		}
 
-		ah->ar_hrd = htons(t->me.sll_hatype);
+		ah->ar_hrd = htons(t->cold->me.sll_hatype);
 		if(ah->ar_hrd == htons(ARPHRD_FDDI))
 			ah->ar_hrd = htons(ARPHRD_ETHER);
 		ah->ar_pro = htons(ETH_P_IP);
-		ah->ar_hln = t->me.sll_halen;
+		ah->ar_hln = t->cold->me.sll_halen;
 		ah->ar_pln = 4;
 		ah->ar_op = htons(ARPOP_REQUEST);
 
-		memcpy(p, &t->me.sll_addr, ah->ar_hln);
-		p += t->me.sll_halen;
+		memcpy(p, &t->cold->me.sll_addr, ah->ar_hln);
+		p += t->cold->me.sll_halen;
 
-		memcpy(p, &t->src, 4);
+		memcpy(p, &t->cold->src, 4);
 		p += 4;
 
-		memcpy(p, &t->he.sll_addr, ah->ar_hln);
+		memcpy(p, &t->cold->he.sll_addr, ah->ar_hln);
 		p += ah->ar_hln;
 
-		memcpy(p, &t->dst, 4);
+		memcpy(p, &t->cold->dst, 4);
 		p += 4;
 
 #if defined(DEBUG)
@@ -1299,40 +1845,40 @@ static int ping_send(CONFIG *cur) {
 #endif
 
 		if(t->sock != -1) {
-			err = sendto(t->sock, buf, p - buf, 0, (struct sockaddr*)&t->he, sizeof(t->he));
+			err = sendto(t->sock, buf, p - buf, 0, (struct sockaddr*)&t->cold->he, sizeof(t->cold->he));
 			if(err < 0) {
 				if(cfg.debug >= 9) syslog(LOG_ERR, "arping sendto failed to %s on %s reason \"%s\"", cur->name, cur->device, strerror(errno));
-				close(t->sock);
-				t->sock = -1;
+				close_sock(t);
 			}
 		} else {
 			if(cfg.debug >= 9) syslog(LOG_INFO, "arping sendto socket not open for %s", cur->name);
 			err = -1;
 		}
 
-		{ /* we don't care what the error was just advance with seq */
-			int seq;
+		/* we don't care what the error was just advance with seq */
+		slot_send(t, now, err == -1);
 
-			seq = t->seq % FOLLOWED_PKTS;
-			t->sentpkts[seq].seq = t->seq;
-			t->sentpkts[seq].sent_time = t->last_send_time;
-			t->sentpkts[seq].flags.replied = 0;
-			t->sentpkts[seq].flags.timeout = 0;
-			t->sentpkts[seq].flags.waiting = 1;
-			if(t->sentpkts[seq].flags.used == 0) t->used++;
-			t->sentpkts[seq].flags.used = 1;
-			t->sentpkts[seq].flags.error = (err == -1) ? 1 : 0;
-
-			t->seq = (t->seq + 1) % SEQ_LIMITER; /* limit seq so that consecutive missing and received pkt counting doesn't get confused when seq "overflows" */
-			t->num_sent++;
-
-		}
 		if(err == (p - buf)) {
 			return(0);
 		}
 		return(err);
 	}
 
+	/* icmp probes are queued and go out together in send_flush() */
+	if((i = snd_take()) == -1) {
+		send_flush();
+		i = snd_take();
+	}
+
+	/* every slot is still in flight with io_uring, count the probe as a send error */
+	if(i == -1) {
+		slot_send(t, now, 1);
+		if(cfg.debug >= 9) syslog(LOG_ERR, "ping send to %s dropped, all send slots busy", cur->name);
+		return(-1);
+	}
+
+	buf = snd_bufs[i];
+
 	if(cur->dstinfo->ai_family == AF_INET6) {
 		struct icmp6_hdr *icp6;
 
@@ -1345,152 +1891,387 @@ static int ping_send(CONFIG *cur) {
 		icp6->icmp6_type = ICMP6_ECHO_REQUEST;
 		icp6->icmp6_code = 0;
 		icp6->icmp6_seq = htons(t->seq); /* I saw a tcpdump suggesting that there is something wrong with seq thus htons() */
-		icp6->icmp6_id = get_ident();
+		icp6->icmp6_id = cur->ping_socket ? 0 : get_ident(); /* ping sockets use their own id */
 
 		pdp = (PING_DATA *)(buf + sizeof(struct icmp6_hdr));
 		pdp->ping_count = t->num_sent;
-		pdp->ping_ts = t->last_send_time;
+		pdp->ping_ts = now;
 		pdp->id = t->id;
 
 		icp6->icmp6_cksum = 0; /* the ipv6 stack calculates the checksum for us */
+	} else {
+		ping_pkt_size = sizeof(struct icmp) + sizeof(PING_DATA);
 
-		if(t->sock != -1) {
-			if(cfg.debug >= 9) syslog(LOG_INFO, "cmsglen = %d", t->cmsglen);
-
-			if(t->cmsglen == 0) {
-				n = sendto(t->sock, buf, ping_pkt_size, 0, (struct sockaddr *)&t->dst_addr6, sizeof(t->dst_addr6));
-				if(n < 0) {
-					if(errno == ENODEV) {
-						if(cfg.debug >= 9) syslog(LOG_ERR, "connection %s no such device %s \"%s\"", cur->name, cur->device, strerror(errno));
-					} else
-						if (cfg.debug >= 9) syslog(LOG_ERR, "ping6 sendto failed to %s on %s reason \"%s\"", cur->name, cur->device, strerror(errno));
-
-					if(t->sock != -1) {
-						close(t->sock);
-						t->sock = -1;
-					}
-				}
-			} else {
-				struct msghdr mhdr;
-				struct iovec iov;
-				int confirm = 0;
-
-				iov.iov_len = ping_pkt_size;
-				iov.iov_base = buf;
-
-				mhdr.msg_name = &t->dst_addr6;
-				mhdr.msg_namelen = sizeof(struct sockaddr_in6);
-				mhdr.msg_iov = &iov;
-				mhdr.msg_iovlen = 1;
-				mhdr.msg_control = t->cmsgbuf;
-				mhdr.msg_controllen = t->cmsglen;
-
-				n = sendmsg(t->sock, &mhdr, confirm);
-				if(cfg.debug >= 9 && n < 0) syslog(LOG_INFO, "sendmsg failed for %s %s", cur->name, strerror(errno));
-				if(n < 0) {
-					close(t->sock);
-					t->sock = -1;
-				}
-			}
-		} else {
-			if(cfg.debug >= 9) syslog(LOG_INFO, "ping sendto socket not open for %s", cur->name);
-			n = -1;
-		}
-		{
-			/* we don't care what the error was just advance with seq */
-			int seq;
+		memset(buf, 0, ping_pkt_size);
+
+		icp = (struct icmp *)buf;
+
+		icp->icmp_type = ICMP_ECHO;
+		icp->icmp_code = 0;
+		icp->icmp_cksum = 0;
+		icp->icmp_seq = t->seq;
+		icp->icmp_id = cur->ping_socket ? 0 : get_ident(); /* ping sockets use their own id */
+
+		pdp = (PING_DATA *)(buf + sizeof(struct icmp));
+		pdp->ping_count = t->num_sent;
+		pdp->ping_ts = now;
+		pdp->id = t->id;
+
+		/* the kernel checksums ping socket packets */
+		if(!cur->ping_socket)
+			icp->icmp_cksum = in_cksum((u_short *)icp, ping_pkt_size);
+	}
 
-			seq = t->seq % FOLLOWED_PKTS;
+	/* the slot is marked waiting now, send_flush() flags it if the send fails */
+	seq = t->seq % t->window;
 #if defined(DEBUG)
-			fprintf(stderr, "ping_send seq = %d to %s, num_sent = %ld, %ld, pkt_size = %d\n", t->seq, inet_ntoa(t->dst_addr.sin_addr), t->num_sent, pdp->ping_count, ping_pkt_size);
+	fprintf(stderr, "ping_send seq = %d to %s, num_sent = %ld, %ld, pkt_size = %d\n", t->seq, cur->checkip, t->num_sent, pdp->ping_count, ping_pkt_size);
 #endif
-			t->sentpkts[seq].seq = t->seq;
-			t->sentpkts[seq].sent_time = t->last_send_time;
-			t->sentpkts[seq].flags.replied = 0;
-			t->sentpkts[seq].flags.timeout = 0;
-			t->sentpkts[seq].flags.waiting = 1;
-			if(t->sentpkts[seq].flags.used == 0) t->used++;
-			t->sentpkts[seq].flags.used = 1;
-			t->sentpkts[seq].flags.error = (n < 1) ? 1 : 0;
-
-			t->seq = (t->seq + 1) % SEQ_LIMITER;
-			/* limit seq so that consecutive missing and received pkt counting doesn't get confused when seq "overflows" */
-			t->num_sent++;
-		}
-		if(n == ping_pkt_size) {
-			return(0);
-		}
+	slot_send(t, now, t->sock == -1);
 
-		return(n);
+	if(t->sock == -1) {
+		if(cfg.debug >= 9) syslog(LOG_INFO, "ping sendto socket not open for %s", cur->name);
+		snd_give(i);
+		return(-1);
 	}
 
-	/* send a ping packet */
-	ping_pkt_size = sizeof(struct icmp) + sizeof(PING_DATA);
+	snd_iov[i].iov_base = buf;
+	snd_iov[i].iov_len = ping_pkt_size;
 
-	memset(buf, 0, ping_pkt_size);
+	mhdr = &snd_msgs[i].msg_hdr;
+	memset(mhdr, 0, sizeof(*mhdr));
+	if(cur->dstinfo->ai_family == AF_INET6) {
+		mhdr->msg_name = &t->cold->dst_addr6;
+		mhdr->msg_namelen = sizeof(struct sockaddr_in6);
+	} else {
+		mhdr->msg_name = &t->cold->dst_addr;
+		mhdr->msg_namelen = sizeof(struct sockaddr_in);
+	}
+	mhdr->msg_iov = &snd_iov[i];
+	mhdr->msg_iovlen = 1;
+	if(t->cold->cmsglen) {
+		mhdr->msg_control = t->cold->cmsgbuf;
+		mhdr->msg_controllen = t->cold->cmsglen;
+	}
 
-	icp = (struct icmp *)buf;
+	snd_conf[i] = cur;
+	snd_sock[i] = t->sock;
+	snd_slot[i] = seq;
+	snd_queue[snd_cnt++] = i;
 
-	icp->icmp_type = ICMP_ECHO;
-	icp->icmp_code = 0;
-	icp->icmp_cksum = 0;
-	icp->icmp_seq = t->seq;
-	icp->icmp_id = get_ident();
+	return(0);
+}
 
-	pdp = (PING_DATA *)(buf + sizeof(struct icmp));
-	pdp->ping_count = t->num_sent;
-	pdp->ping_ts = t->last_send_time;
-	pdp->id = t->id;
+/*
+  Submit the queued probes with one sendmmsg() per socket. A message the
+  kernel refuses is flagged as an error in its history slot and the
+  rest of the batch is carried on with.
+*/
+static void send_flush(void)
+{
+	struct mmsghdr vec[SEND_BATCH];
+	int idx[SEND_BATCH];
+	char done[SEND_BATCH];
+	int i, j, cnt, off, n;
+
+#ifdef HAVE_IO_URING
+	if(use_uring) {
+		uring_send_flush();
+		return;
+	}
+#endif
 
-	icp->icmp_cksum = in_cksum((u_short *)icp, ping_pkt_size);
+	memset(done, 0, sizeof(done));
 
-	if(t->sock != -1) {
-		n = sendto(t->sock, buf, ping_pkt_size, 0, (struct sockaddr *)&t->dst_addr, sizeof(struct sockaddr));
+	for(i = 0; i < snd_cnt; i++) {
+		int sock = snd_sock[snd_queue[i]];
 
-		if(n < 0) {
-			if(errno == ENODEV) {
-				if(cfg.debug >= 9) syslog(LOG_ERR, "connection %s no such device %s \"%s\"", cur->name, cur->device, strerror(errno));
-				/* exit(2); */ /* commented out. handle this situation like the packet had been sent. see below.  */
-			}
-			else
-				if(cfg.debug >= 9) syslog(LOG_ERR, "ping sendto failed to %s on %s reason \"%s\"", cur->name, cur->device, strerror(errno));
+		if(done[i]) continue;
+
+		/* gather every queued message for this socket */
+		for(j = i, cnt = 0; j < snd_cnt; j++) {
+			if(done[j] || snd_sock[snd_queue[j]] != sock) continue;
+			done[j] = 1;
+			idx[cnt] = snd_queue[j];
+			vec[cnt++] = snd_msgs[snd_queue[j]];
+		}
 
-			if(t->sock != -1) {
-				close(t->sock);
-				t->sock = -1;
+		for(off = 0; off < cnt; ) {
+			if((n = sendmmsg(sock, vec + off, cnt - off, 0)) > 0) {
+				off += n;
+				continue;
 			}
+
+			/* the message at off failed, flag it and go on with the rest */
+			send_failed(idx[off], errno);
+			off++;
 		}
+	}
+
+	for(i = 0; i < snd_cnt; i++) snd_give(snd_queue[i]);
+	snd_cnt = 0;
+}
+
+/* a free send slot, or -1 when all are taken */
+static int snd_take(void)
+{
+	if(snd_nfree) return(snd_free[--snd_nfree]);
+	if(snd_used < SEND_BATCH) return(snd_used++);
+
+	return(-1);
+}
+
+static void snd_give(int i)
+{
+	snd_free[snd_nfree++] = i;
+}
+
+/* flag queued message i as an error and drop the socket it failed on */
+static void send_failed(int i, int err)
+{
+	CONFIG *cur = snd_conf[i];
+	TARGET *t = cur->data;
+
+	if(err == ENODEV) {
+		if(cfg.debug >= 9) syslog(LOG_ERR, "connection %s no such device %s \"%s\"", cur->name, cur->device, strerror(err));
+	} else
+		if(cfg.debug >= 9) syslog(LOG_ERR, "ping send failed to %s on %s reason \"%s\"", cur->name, cur->device, strerror(err));
+
+	BIT_SET(t->cold->hist.error, snd_slot[i]);
+	mark_dirty(t);
+	if(t->sock == snd_sock[i]) close_sock(t);
+}
+
+#ifdef HAVE_IO_URING
+static int uring_setup(void)
+{
+	if(uring_init(URING_ENTRIES) != 0) return(1);
+
+	if(uring_bufs_init(UR_BGID, URING_BUFS, UR_BUFSIZE) != 0) {
+		uring_free();
+		return(1);
+	}
+
+	/* layout of each receive buffer: header, address, ancillary data, datagram */
+	memset(&ur_msg, 0, sizeof(ur_msg));
+	ur_msg.msg_namelen = UR_NAMELEN;
+	ur_msg.msg_controllen = RECV_CTRLSIZE;
+
+	return(0);
+}
+
+/* queue the multishot receive or error queue poll of a watched socket */
+static int uring_arm(int sock, int tag)
+{
+	struct io_uring_sqe *sqe;
+
+	if((sqe = uring_get_sqe()) == NULL) {
+		syslog(LOG_ERR, "%s: %s: io_uring submission queue full", __FILE__, __FUNCTION__);
+		return(1);
+	}
+
+	sqe->fd = sock;
+	sqe->user_data = UR_DATA(ur_regs[sock].gen, sock, tag);
+
+	if(tag == UR_RECV) {
+		sqe->opcode = IORING_OP_RECVMSG;
+		sqe->addr = (unsigned long)&ur_msg;
+		sqe->len = 1;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = UR_BGID;
 	} else {
-		if(cfg.debug >= 9) syslog(LOG_INFO, "ping sendto socket not open for %s", cur->name);
-		n = -1;
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->len = IORING_POLL_ADD_MULTI;
+		sqe->poll32_events = POLLERR;
 	}
 
-	{ /* we don't care what the error was just advance with seq */
-		int seq;
+	return(0);
+}
 
-		seq = t->seq % FOLLOWED_PKTS;
-#if defined(DEBUG)
-		fprintf(stderr, "ping_send seq = %d to %s, num_sent = %ld, %ld, pkt_size = %d\n", t->seq, inet_ntoa(t->dst_addr.sin_addr), t->num_sent, pdp->ping_count, ping_pkt_size);
-#endif
-		t->sentpkts[seq].seq = t->seq;
-		t->sentpkts[seq].sent_time = t->last_send_time;
-		t->sentpkts[seq].flags.replied = 0;
-		t->sentpkts[seq].flags.timeout = 0;
-		t->sentpkts[seq].flags.waiting = 1;
-		if(t->sentpkts[seq].flags.used == 0) t->used++;
-		t->sentpkts[seq].flags.used = 1;
-		t->sentpkts[seq].flags.error = (n < 1) ? 1 : 0;
+/* move completions off the ring, sends are settled and their slots given back right away */
+static void uring_reap(void)
+{
+	struct io_uring_cqe *cqe;
+
+	while((cqe = uring_peek_cqe()) != NULL) {
+		unsigned long long data = cqe->user_data;
+
+		if(UR_TAG(data) == UR_SEND) {
+			ur_sends--;
+			if(cqe->res < 0) send_failed(UR_SOCK(data), -cqe->res);
+			snd_give(UR_SOCK(data));
+		} else if(UR_TAG(data) != UR_CANCEL) {
+			if(ur_ncqes == ur_maxcqes) {
+				struct io_uring_cqe *cqes;
+				int n = ur_maxcqes ? 2 * ur_maxcqes : URING_ENTRIES;
+
+				if((cqes = realloc(ur_cqes, n * sizeof(struct io_uring_cqe))) == NULL) {
+					syslog(LOG_ERR, "%s: %s: failed to realloc completion list", __FILE__, __FUNCTION__);
+					break;
+				}
+				ur_cqes = cqes;
+				ur_maxcqes = n;
+			}
+			ur_cqes[ur_ncqes++] = *cqe;
+		}
 
-		t->seq = (t->seq + 1) % SEQ_LIMITER; /* limit seq so that consecutive missing and received pkt counting doesn't get confused when seq "overflows" */
-		t->num_sent++;
+		uring_cqe_seen();
 	}
+}
 
-	if(n == ping_pkt_size) {
-		return(0);
+/*
+  Submit the queued probes with one io_uring_enter() and go on. Each
+  probe keeps its send slot until its completion comes in with the
+  others, see uring_reap().
+*/
+static void uring_send_flush(void)
+{
+	int i;
+
+	for(i = 0; i < snd_cnt; i++) {
+		struct io_uring_sqe *sqe;
+		int k = snd_queue[i];
+
+		if((sqe = uring_get_sqe()) == NULL) {
+			send_failed(k, EBUSY);
+			snd_give(k);
+			continue;
+		}
+
+		/* the socket field carries the send slot */
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = snd_sock[k];
+		sqe->addr = (unsigned long)&snd_msgs[k].msg_hdr;
+		sqe->len = 1;
+		sqe->user_data = UR_DATA(0, k, UR_SEND);
+		ur_sends++;
 	}
-	return(n);
+
+	snd_cnt = 0;
+
+	/* most sends complete while being submitted */
+	if(uring_enter(0, -1) == 0) uring_reap();
+}
+
+/* sends in flight point into the connections, wait for them before those go */
+static void uring_send_drain(void)
+{
+	if(!use_uring) return;
+
+	while(ur_sends > 0) {
+		if(uring_enter(1, -1) != 0) {
+			syslog(LOG_ERR, "%s: %s: io_uring wait failed with %d sends in flight", __FILE__, __FUNCTION__, ur_sends);
+			/* nothing more will come back, take every slot back */
+			ur_sends = 0;
+			snd_nfree = 0;
+			snd_used = 0;
+			break;
+		}
+		uring_reap();
+	}
+}
+
+static int uring_wait(CONFIG **ctable, long usec)
+{
+	int64_t current_time;
+	int i, cnt = 0;
+
+	if(ur_ncqes == 0) {
+		uring_enter(1, usec);
+		uring_reap();
+	}
+
+	if(ur_ncqes == 0) return(0);
+
+	current_time = nstime_now();
+
+	for(i = 0; i < ur_ncqes; i++) {
+		struct io_uring_cqe *cqe = &ur_cqes[i];
+		int sock = UR_SOCK(cqe->user_data);
+		int tag = UR_TAG(cqe->user_data);
+		void *owner = NULL;
+		CONFIG *cur = NULL;
+
+		if(sock < ur_nregs && ur_regs[sock].gen == UR_GEN(cqe->user_data)) owner = ur_regs[sock].owner;
+
+		/* shared sockets carry no connection, replies are matched by id */
+		if(owner && owner != &shared_icmp4 && owner != &shared_icmp6) cur = owner;
+
+		if(tag == UR_ERR) {
+			/* transmit timestamps are looped back through the error queue */
+			if(owner && cqe->res > 0) {
+				int n;
+
+				do {
+					int j;
+
+					if((n = ping_rcv(sock, MSG_ERRQUEUE)) < 0) break;
+
+					for(j = 0; j < n; j++) {
+						handle_tx_stamp(ctable, rcv_bufs[j], rcv_msgs[j].msg_len, &rcv_msgs[j].msg_hdr);
+					}
+				} while(n == RECV_BATCH);
+			}
+		} else if(cqe->flags & IORING_CQE_F_BUFFER) {
+			unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+			if(owner && cqe->res > 0) cnt += uring_recv(ctable, cur, uring_buf(bid), cqe->res, current_time);
+			uring_buf_recycle(bid);
+		}
+
+		if(cqe->flags & IORING_CQE_F_MORE) continue;
+
+		/* the multishot request ended, put it back unless the socket went away */
+		if(!owner || cqe->res == -ECANCELED) continue;
+
+		if(cqe->res < 0 && cqe->res != -ENOBUFS) {
+			if(cur) {
+				if(cfg.debug >= 9) syslog(LOG_INFO, "io_uring receive failed with connection %s \"%s\"", cur->name, strerror(-cqe->res));
+				close_sock(cur->data);
+				continue;
+			}
+			if(cfg.debug >= 9) syslog(LOG_INFO, "io_uring receive failed on shared socket \"%s\"", strerror(-cqe->res));
+		}
+
+		uring_arm(sock, tag);
+	}
+
+	uring_bufs_commit();
+	ur_ncqes = 0;
+
+	return(cnt);
 }
 
+/* hand one datagram out of a multishot receive buffer to handle_reply */
+static int uring_recv(CONFIG **ctable, CONFIG *cur, char *buf, int len, int64_t current_time)
+{
+	struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buf;
+	char *name = buf + sizeof(*out);
+	char *ctrl = name + UR_NAMELEN;
+	char *payload = ctrl + RECV_CTRLSIZE;
+	struct msghdr mhdr;
+	FROM_ADDR from;
+	int plen;
+
+	if(len < payload - buf) return(0);
+
+	plen = len - (payload - buf);
+	if(out->payloadlen < (__u32)plen) plen = out->payloadlen;
+
+	memset(&from, 0, sizeof(from));
+	memcpy(&from, name, out->namelen < sizeof(from) ? out->namelen : sizeof(from));
+
+	memset(&mhdr, 0, sizeof(mhdr));
+	mhdr.msg_control = ctrl;
+	mhdr.msg_controllen = out->controllen;
+
+	handle_reply(ctable, cur, payload, plen, &from, rcv_stamp(&mhdr, current_time));
+
+	return(1);
+}
+#endif
+
 static int event_script_check(const char *path)
 {
 	struct stat statbuf;
@@ -1524,16 +2305,30 @@ static void init_config_data(CONFIG *first, CONFIG *last, CONFIG ***ctable)
 	int i;
 	CONFIG *cur;
 	TARGET *t = NULL;
+	int64_t now;
+
+	char *hist;
+	size_t hist_size = 0;
+
+	for(cur = first, num_hosts = 0; cur; cur = cur->next, num_hosts++) hist_size += hist_bytes(cur->followed_pkts);
+
+	if((targets = calloc(num_hosts, sizeof(TARGET))) == NULL || (targets_cold = calloc(num_hosts, sizeof(TARGET_COLD))) == NULL || (hist_pool = calloc(1, hist_size)) == NULL) {
+		syslog(LOG_ERR, "main: initializing targets failed to malloc");
+		exit(1);
+	}
 
 	/* initialize config->data */
-	for(cur = first, num_hosts = 0; cur; cur = cur->next, num_hosts++) {
+	for(cur = first, i = 0, hist = hist_pool; cur; cur = cur->next, i++) {
 		u_int ipaddress;
 
-		if((t = malloc(sizeof(TARGET))) == NULL) {
-			syslog(LOG_ERR, "main: initializing targets failed to malloc");
-			exit(1);
-		}
-		memset(t, 0, sizeof(TARGET));
+		t = &targets[i];
+		t->cold = &targets_cold[i];
+
+		/* the seq space is cut to whole windows so that slot = seq % window survives the wrap */
+		t->window = cur->followed_pkts;
+		t->seq_limit = (0x10000 / t->window) * t->window;
+		hist_carve(&t->cold->hist, hist, t->window);
+		hist += hist_bytes(t->window);
 
 		cur->data = t;
 
@@ -1541,17 +2336,17 @@ static void init_config_data(CONFIG *first, CONFIG *last, CONFIG ***ctable)
 		t->seq = 0;
 		t->downseq = 0;
 		t->downseqreported = 0;
-		t->last_send_time.tv_sec = 0;
-		t->last_send_time.tv_usec = 0;
 		t->num_sent = 0;
 		t->timeout_max = 0;
 		t->consecutive_missing_max = 0;
 		t->used = 0;
 
-		memset(t->cmsgbuf, 0, sizeof(t->cmsgbuf));
-		t->cmsglen = 0;
+		memset(t->cold->cmsgbuf, 0, sizeof(t->cold->cmsgbuf));
+		t->cold->cmsglen = 0;
 
-		t->id = num_hosts;
+		t->id = i;
+		t->tmo_at = INT64_MAX;
+		loss_win_init(&t->cold->loss_win, cur->loss_window_s);
 
 		/* get initial connection state assumption from config */
 		t->status = cur->status;
@@ -1561,48 +2356,179 @@ static void init_config_data(CONFIG *first, CONFIG *last, CONFIG ***ctable)
 		if(cur->dstinfo->ai_family == AF_INET6) {
 			/* ipv6 init */
 			if(cur->srcinfo) {
-				if(inet_pton(AF_INET6, cur->sourceip, &t->src6) != 1) {
+				if(inet_pton(AF_INET6, cur->sourceip, &t->cold->src6) != 1) {
+					syslog(LOG_ERR, "%s: %s: src6 inet_pton failed for %s", __FILE__, __FUNCTION__, cur->name);
+				}
+
+				t->cold->src_addr6.sin6_family = cur->srcinfo->ai_family;
+				if(inet_pton(AF_INET6, cur->sourceip, &t->cold->src_addr6.sin6_addr) != 1) {
 					syslog(LOG_ERR, "%s: %s: src6 inet_pton failed for %s", __FILE__, __FUNCTION__, cur->name);
 				}
+			}
+
+			if(inet_pton(AF_INET6, cur->checkip, &t->cold->dst6) != 1) {
+				syslog(LOG_ERR, "%s: %s: dst6 inet_pton failed for %s", __FILE__, __FUNCTION__, cur->name);
+			}
+
+			t->cold->dst_addr6.sin6_family = cur->dstinfo->ai_family;
+			if(inet_pton(AF_INET6, cur->checkip, &t->cold->dst_addr6.sin6_addr) != 1) {
+				syslog(LOG_ERR, "%s: %s: dst6 inet_pton failed for %s", __FILE__, __FUNCTION__, cur->name);
+			}
+		} else {
+			/* ipv4 init */
+			ipaddress = inet_addr(cur->checkip);
+			t->cold->dst_addr.sin_family = AF_INET;
+			t->cold->dst_addr.sin_addr = *((struct in_addr *)&ipaddress);
+			t->cold->dst = *((struct in_addr *)&ipaddress);
+			if(cur->srcinfo) {
+				if(inet_pton(AF_INET, cur->sourceip, &t->cold->src) != 1) {
+					syslog(LOG_ERR, "%s: %s: src inet_pton failed for %s", __FILE__, __FUNCTION__, cur->name);
+				}
+			}
+		}
+	}
+
+	if(((*ctable) = (CONFIG **)malloc(sizeof(CONFIG *) * num_hosts)) == NULL) {
+		syslog(LOG_ERR, "main: can't malloc for ctable");
+		exit(1);
+	}
+
+	/* create pointer table */
+	for(cur = first, i = 0; cur; cur = cur->next, i++) {
+		(*ctable)[i] = cur;
+	}
+
+	/* spread the first probes evenly over the send interval so that
+	   connections with equal intervals don't all come due at once */
+	if(sched_init(num_hosts)) exit(1);
+
+	if(dirty_init(num_hosts)) exit(1);
+
+	now = nstime_now();
+	for(cur = first; cur; cur = cur->next) {
+		long phase;
+
+		t = cur->data;
+		phase = (long)send_interval_ms(cur) * 1000L * t->id / num_hosts;
+
+		t->next_send = now + phase * NSEC_PER_USEC;
+		sched_add(cur);
+	}
+
+}
+
+/*
+  Watch a socket for replies on behalf of owner, a connection or one of
+  the shared sockets, which is handed back with every completion.
+*/
+static int poll_add(int sock, void *owner)
+{
+	struct epoll_event ev;
+
+#ifdef HAVE_IO_URING
+	if(use_uring) {
+		if(sock >= ur_nregs) {
+			URING_REG *regs;
+			int n = sock + 64;
+
+			if((regs = realloc(ur_regs, n * sizeof(URING_REG))) == NULL) {
+				syslog(LOG_ERR, "%s: %s: failed to realloc io_uring registrations", __FILE__, __FUNCTION__);
+				return(1);
+			}
+			memset(regs + ur_nregs, 0, (n - ur_nregs) * sizeof(URING_REG));
+			ur_regs = regs;
+			ur_nregs = n;
+		}
+
+		ur_regs[sock].owner = owner;
+
+		if(uring_arm(sock, UR_RECV) || uring_arm(sock, UR_ERR)) {
+			poll_del(sock);
+			return(1);
+		}
+		return(0);
+	}
+#endif
 
-				t->src_addr6.sin6_family = cur->srcinfo->ai_family;
-				if(inet_pton(AF_INET6, cur->sourceip, &t->src_addr6.sin6_addr) != 1) {
-					syslog(LOG_ERR, "%s: %s: src6 inet_pton failed for %s", __FILE__, __FUNCTION__, cur->name);
-				}
-			}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = owner;
 
-			if(inet_pton(AF_INET6, cur->checkip, &t->dst6) != 1) {
-				syslog(LOG_ERR, "%s: %s: dst6 inet_pton failed for %s", __FILE__, __FUNCTION__, cur->name);
-			}
+	if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &ev) == -1) {
+		syslog(LOG_ERR, "failed to add socket to epoll set \"%s\"", strerror(errno));
+		return(1);
+	}
+	return(0);
+}
 
-			t->dst_addr6.sin6_family = cur->dstinfo->ai_family;
-			if(inet_pton(AF_INET6, cur->checkip, &t->dst_addr6.sin6_addr) != 1) {
-				syslog(LOG_ERR, "%s: %s: dst6 inet_pton failed for %s", __FILE__, __FUNCTION__, cur->name);
-			}
-		} else {
-			/* ipv4 init */
-			ipaddress = inet_addr(cur->checkip);
-			t->dst_addr.sin_family = AF_INET;
-			t->dst_addr.sin_addr = *((struct in_addr *)&ipaddress);
-			t->dst = *((struct in_addr *)&ipaddress);
-			if(cur->srcinfo) {
-				if(inet_pton(AF_INET, cur->sourceip, &t->src) != 1) {
-					syslog(LOG_ERR, "%s: %s: src inet_pton failed for %s", __FILE__, __FUNCTION__, cur->name);
-				}
-			}
+static void poll_del(int sock)
+{
+#ifdef HAVE_IO_URING
+	if(use_uring) {
+		struct io_uring_sqe *sqe;
+
+		if(sock < ur_nregs) {
+			ur_regs[sock].owner = NULL;
+			ur_regs[sock].gen++;
 		}
+
+		/* requests are cancelled by file, so this must reach the kernel before the close */
+		if((sqe = uring_get_sqe()) != NULL) {
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->fd = sock;
+			sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+			sqe->user_data = UR_CANCEL;
+		}
+		uring_enter(0, -1);
+		return;
 	}
+#endif
 
-	if(((*ctable) = (CONFIG **)malloc(sizeof(CONFIG *) * num_hosts)) == NULL) {
-		syslog(LOG_ERR, "main: can't malloc for ctable");
-		exit(1);
+	/* a forked child may still hold the descriptor, so remove it explicitly */
+	if(epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sock, NULL) == -1) {
+		if(cfg.debug >= 9) syslog(LOG_INFO, "failed to remove socket from epoll set \"%s\"", strerror(errno));
 	}
+}
 
-	/* create pointer table */
-	for(cur = first, i = 0; cur; cur = cur->next, i++) {
-		(*ctable)[i] = cur;
+/*
+  Register a freshly opened connection socket with the receive loop.
+  The connection pointer is handed back with every wakeup so replies can
+  be dispatched without scanning the connection list.
+*/
+static int poll_add_sock(CONFIG *cur)
+{
+	TARGET *t = (TARGET *)cur->data;
+
+	if(poll_add(t->sock, cur)) {
+		syslog(LOG_ERR, "failed to watch socket of %s", cur->name);
+		close(t->sock);
+		t->sock = -1;
+		return(1);
+	}
+	return(0);
+}
+
+static void close_sock(TARGET *t)
+{
+	SHARED_SOCK *ss = NULL;
+
+	if(t->sock == -1) return;
+
+	if(t->sock == shared_icmp4.sock) ss = &shared_icmp4;
+	else if(t->sock == shared_icmp6.sock) ss = &shared_icmp6;
+
+	/* a shared socket is only closed when its last user lets go */
+	if(ss) {
+		t->sock = -1;
+		if(--ss->users > 0) return;
+		t->sock = ss->sock;
+		ss->sock = -1;
+		ss->users = 0;
 	}
 
+	poll_del(t->sock);
+	close(t->sock);
+	t->sock = -1;
 }
 
 static int open_arp_sock(CONFIG *cur)
@@ -1626,6 +2552,8 @@ static int open_arp_sock(CONFIG *cur)
 	if(fcntl(t->sock, F_SETFD, FD_CLOEXEC) == -1) {
 		syslog(LOG_ERR, "failed to set close on exec on socket %s reason \"%s\"", cur->name, strerror(errno));
 	}
+	if(poll_add_sock(cur) != 0) return(1);
+	enable_timestamps(t->sock, 0);
 
 	if(cur->device && *cur->device) {
 		struct ifreq ifr;
@@ -1634,96 +2562,85 @@ static int open_arp_sock(CONFIG *cur)
 		strncpy(ifr.ifr_name, cur->device, IFNAMSIZ-1);
 		if(ioctl(t->sock, SIOCGIFINDEX, &ifr) < 0) {
 			syslog(LOG_ERR, "unknown iface \"%s\"", cur->device);
-			close(t->sock);
-			t->sock = -1;
+			close_sock(t);
 			return(2);
 		}
 		ifindex = ifr.ifr_ifindex;
 
 		if(ioctl(t->sock, SIOCGIFFLAGS, (char*)&ifr)) {
 			syslog(LOG_ERR, "ioctl(SIOCGIFFLAGS) \"%s\"", strerror(errno));
-			close(t->sock);
-			t->sock = -1;
+			close_sock(t);
 			return(2);
 		}
 		if(!(ifr.ifr_flags&IFF_UP)) {
 			syslog(LOG_ERR, "Interface \"%s\" is down", cur->device);
-			close(t->sock);
-			t->sock = -1;
+			close_sock(t);
 			return(2);
 		}
 		if(ifr.ifr_flags&(IFF_NOARP|IFF_LOOPBACK)) {
 			syslog(LOG_ERR, "Interface \"%s\" is not ARPable", cur->device);
-			close(t->sock);
-			t->sock = -1;
+			close_sock(t);
 			return(2);
 		}
 	}
 
-	if(inet_aton(cur->checkip, &t->dst) != 1) {
+	if(inet_aton(cur->checkip, &t->cold->dst) != 1) {
 		struct hostent *hp;
 		hp = gethostbyname2(cur->checkip, AF_INET);
 		if(!hp) {
 			syslog(LOG_ERR, "unknown host %s\n", cur->checkip);
-			close(t->sock);
-			t->sock = -1;
+			close_sock(t);
 			return(2);
 		}
-		memcpy(&t->dst, hp->h_addr, 4);
+		memcpy(&t->cold->dst, hp->h_addr, 4);
 	}
 
 	if(cur->sourceip && *cur->sourceip)
-		if(inet_aton(cur->sourceip, &t->src) != 1) {
+		if(inet_aton(cur->sourceip, &t->cold->src) != 1) {
 			syslog(LOG_ERR, "invalid source %s\n", cur->sourceip);
-			close(t->sock);
-			t->sock = -1;
+			close_sock(t);
 			return(2);
 		}
 
 	if(probe_src_ip_addr(cur) != 0) {
-		close(t->sock);
-		t->sock = -1;
+		close_sock(t);
 		return(2);
 	}
 
-	t->me.sll_family = AF_PACKET;
-	t->me.sll_ifindex = ifindex;
-	t->me.sll_protocol = htons(ETH_P_ARP);
-	if(bind(t->sock, (struct sockaddr*)&t->me, sizeof(t->me)) == -1) {
+	t->cold->me.sll_family = AF_PACKET;
+	t->cold->me.sll_ifindex = ifindex;
+	t->cold->me.sll_protocol = htons(ETH_P_ARP);
+	if(bind(t->sock, (struct sockaddr*)&t->cold->me, sizeof(t->cold->me)) == -1) {
 		syslog(LOG_ERR, "bind \"%s\"", strerror(errno));
-		close(t->sock);
-		t->sock = -1;
+		close_sock(t);
 		return(2);
 	}
 
 	{
-		int alen = sizeof(t->me);
-		if(getsockname(t->sock, (struct sockaddr*)&t->me, (socklen_t*)&alen) == -1) {
+		int alen = sizeof(t->cold->me);
+		if(getsockname(t->sock, (struct sockaddr*)&t->cold->me, (socklen_t*)&alen) == -1) {
 			syslog(LOG_ERR, "getsockname \"%s\"", strerror(errno));
-			close(t->sock);
-			t->sock = -1;
+			close_sock(t);
 			return(2);
 		}
 	}
-	if(t->me.sll_halen == 0) {
+	if(t->cold->me.sll_halen == 0) {
 		syslog(LOG_ERR, "Interface \"%s\" is not ARPable (no ll address)", cur->device);
-		close(t->sock);
-		t->sock = -1;
+		close_sock(t);
 		return(2);
 	}
 
-	t->he = t->me;
-	memset(t->he.sll_addr, -1, min(t->he.sll_halen, sizeof t->he.sll_addr));
+	t->cold->he = t->cold->me;
+	memset(t->cold->he.sll_addr, -1, min(t->cold->he.sll_halen, sizeof t->cold->he.sll_addr));
 
 #if 0
-	printf("ARPING %s ", inet_ntoa(t->dst));
-	printf("from %s %s\n",  inet_ntoa(t->src), cur->device ? : "");
+	printf("ARPING %s ", inet_ntoa(t->cold->dst));
+	printf("from %s %s\n",  inet_ntoa(t->cold->src), cur->device ? : "");
 #endif
 
-	if(!t->src.s_addr) {
+	if(!t->cold->src.s_addr) {
 		syslog(LOG_ERR, "no source address for %s", cur->name);
-		close(t->sock);
-		t->sock = -1;
+		close_sock(t);
 		return(2);
 	}
 	if(cur->ttl) {
@@ -1731,15 +2648,13 @@ static int open_arp_sock(CONFIG *cur)
 		if(setsockopt(t->sock, IPPROTO_IP, IP_MULTICAST_TTL,
 			      &cur->ttl, 1) == -1) {
 			syslog(LOG_ERR, "can't set multicast time-to-live \"%s\"", strerror(errno));
-			close(t->sock);
-			t->sock = -1;
+			close_sock(t);
 			return(2);
 		}
 		if(setsockopt(t->sock, IPPROTO_IP, IP_TTL,
 			      &ittl, sizeof(ittl)) == -1) {
 			syslog(LOG_ERR, "can't set unicast time-to-live \"%s\"", strerror(errno));
-			close(t->sock);
-			t->sock = -1;
+			close_sock(t);
 			return(2);
 		}
 	}
@@ -1747,188 +2662,246 @@ static int open_arp_sock(CONFIG *cur)
 	return(0);
 }
 
-static int open_icmp_sock(CONFIG *cur)
+/*
+  Set the ICMPv6 socket options shared by per-connection and shared
+  sockets: ancillary data reception, checksum offset and the type filter.
+*/
+static int icmp6_sock_opts(int sock)
 {
-	TARGET *t = (TARGET *)cur->data;
-	struct protoent *proto;
-	int pf = cur->dstinfo->ai_family;
-
-	if(t->sock != -1) return(0);
-
-	if(pf == AF_INET6) {
-		if((proto = getprotobyname("ipv6-icmp")) == NULL) {
-			syslog(LOG_ERR, "no ipv6-icmp proto found");
-			return(1);
-		}
-	} else {
-		if((proto = getprotobyname("icmp")) == NULL) {
-			syslog(LOG_ERR, "no icmp proto found");
-			return(1);
-		}
-	}
-
-	t->sock = socket(pf, SOCK_RAW, proto->p_proto);
-
-	if(t->sock < 0) {
-		syslog(LOG_ERR, "could not open socket for ping target \"%s\" reason \"%s\"\n", cur->name, strerror(errno));
-		t->sock = -1;
-		return(1);
-	}
-	if(fcntl(t->sock, F_SETFD, FD_CLOEXEC) == -1) {
-		syslog(LOG_ERR, "failed to set close on exec on socket %s reason \"%s\"", cur->name, strerror(errno));
-	}
-
-	if(pf == AF_INET6) {
-		int opton = 1;
+	struct icmp6_filter filter;
+	int opton = 1;
+	int hold = 1;
 
 #ifdef IPV6_RECVHOPOPTS
-		if(setsockopt(t->sock, IPPROTO_IPV6, IPV6_RECVHOPOPTS, &opton,
-			      sizeof(opton))) {
-			syslog(LOG_ERR, "setsockopt(IPV6_RECVHOPOPTS)");
-			close(t->sock);
-			t->sock = -1;
-			return(2);
-		}
+	if(setsockopt(sock, IPPROTO_IPV6, IPV6_RECVHOPOPTS, &opton,
+		      sizeof(opton))) {
+		syslog(LOG_ERR, "setsockopt(IPV6_RECVHOPOPTS)");
+		return(2);
+	}
 #else  /* old adv. API */
-		if(setsockopt(t->sock, IPPROTO_IPV6, IPV6_HOPOPTS, &opton,
-			      sizeof(opton))) {
-			syslog(LOG_ERR, "setsockopt(IPV6_HOPOPTS)");
-			close(t->sock);
-			t->sock = -1;
-			return(s);
-		}
+	if(setsockopt(sock, IPPROTO_IPV6, IPV6_HOPOPTS, &opton,
+		      sizeof(opton))) {
+		syslog(LOG_ERR, "setsockopt(IPV6_HOPOPTS)");
+		return(2);
+	}
 #endif
 #ifdef IPV6_RECVDSTOPTS
-		if(setsockopt(t->sock, IPPROTO_IPV6, IPV6_RECVDSTOPTS, &opton,
-			      sizeof(opton))) {
-			syslog(LOG_ERR, "setsockopt(IPV6_RECVDSTOPTS)");
-			close(t->sock);
-			t->sock = -1;
-			return(2);
-		}
+	if(setsockopt(sock, IPPROTO_IPV6, IPV6_RECVDSTOPTS, &opton,
+		      sizeof(opton))) {
+		syslog(LOG_ERR, "setsockopt(IPV6_RECVDSTOPTS)");
+		return(2);
+	}
 #else  /* old adv. API */
-		if(setsockopt(t->sock, IPPROTO_IPV6, IPV6_DSTOPTS, &opton,
-			      sizeof(opton))) {
-			syslog(LOG_ERR, "setsockopt(IPV6_DSTOPTS)");
-			close(t->sock);
-			t->sock = -1;
-			return(2);
-		}
+	if(setsockopt(sock, IPPROTO_IPV6, IPV6_DSTOPTS, &opton,
+		      sizeof(opton))) {
+		syslog(LOG_ERR, "setsockopt(IPV6_DSTOPTS)");
+		return(2);
+	}
 #endif
 #ifdef IPV6_RECVRTHDRDSTOPTS
-		if(setsockopt(t->sock, IPPROTO_IPV6, IPV6_RECVRTHDRDSTOPTS, &opton,
-			      sizeof(opton))) {
-			syslog(LOG_ERR, "setsockopt(IPV6_RECVRTHDRDSTOPTS)");
-			close(t->sock);
-			t->sock = -1;
-			return(2);
-		}
+	if(setsockopt(sock, IPPROTO_IPV6, IPV6_RECVRTHDRDSTOPTS, &opton,
+		      sizeof(opton))) {
+		syslog(LOG_ERR, "setsockopt(IPV6_RECVRTHDRDSTOPTS)");
+		return(2);
+	}
 #endif
 #ifdef IPV6_RECVRTHDR
-		if(setsockopt(t->sock, IPPROTO_IPV6, IPV6_RECVRTHDR, &opton,
-			      sizeof(opton))) {
-			syslog(LOG_ERR, "setsockopt(IPV6_RECVRTHDR)");
-			close(t->sock);
-			t->sock = -1;
-			return(2);
-		}
+	if(setsockopt(sock, IPPROTO_IPV6, IPV6_RECVRTHDR, &opton,
+		      sizeof(opton))) {
+		syslog(LOG_ERR, "setsockopt(IPV6_RECVRTHDR)");
+		return(2);
+	}
 #else  /* old adv. API */
-		if(setsockopt(t->sock, IPPROTO_IPV6, IPV6_RTHDR, &opton,
-			      sizeof(opton))) {
-			syslog(LOG_ERR, "setsockopt(IPV6_RTHDR)");
-			close(t->sock);
-			t->sock = -1;
-			return(2);
-		}
+	if(setsockopt(sock, IPPROTO_IPV6, IPV6_RTHDR, &opton,
+		      sizeof(opton))) {
+		syslog(LOG_ERR, "setsockopt(IPV6_RTHDR)");
+		return(2);
+	}
 #endif
 #ifndef USE_SIN6_SCOPE_ID
 #ifdef IPV6_RECVPKTINFO
-		if(setsockopt(t->sock, IPPROTO_IPV6, IPV6_RECVPKTINFO, &opton,
-			      sizeof(opton))) {
-			syslog(LOG_ERR, "setsockopt(IPV6_RECVPKTINFO)");
-			close(t->sock);
-			t->sock = -1;
-			return(2);
-		}
+	if(setsockopt(sock, IPPROTO_IPV6, IPV6_RECVPKTINFO, &opton,
+		      sizeof(opton))) {
+		syslog(LOG_ERR, "setsockopt(IPV6_RECVPKTINFO)");
+		return(2);
+	}
 #else  /* old adv. API */
-		if(setsockopt(t->sock, IPPROTO_IPV6, IPV6_PKTINFO, &opton,
-			      sizeof(opton))) {
-			syslog(LOG_ERR, "setsockopt(IPV6_PKTINFO)");
-			close(t->sock);
-			t->sock = -1;
-			return(2);
-		}
+	if(setsockopt(sock, IPPROTO_IPV6, IPV6_PKTINFO, &opton,
+		      sizeof(opton))) {
+		syslog(LOG_ERR, "setsockopt(IPV6_PKTINFO)");
+		return(2);
+	}
 #endif
 #endif /* USE_SIN6_SCOPE_ID */
 #ifdef IPV6_RECVHOPLIMIT
-		if(setsockopt(t->sock, IPPROTO_IPV6, IPV6_RECVHOPLIMIT, &opton,
-			      sizeof(opton))) {
-			syslog(LOG_ERR, "setsockopt(IPV6_RECVHOPLIMIT)");
-			close(t->sock);
-			t->sock = -1;
-			return(2);
-		}
+	if(setsockopt(sock, IPPROTO_IPV6, IPV6_RECVHOPLIMIT, &opton,
+		      sizeof(opton))) {
+		syslog(LOG_ERR, "setsockopt(IPV6_RECVHOPLIMIT)");
+		return(2);
+	}
 #else  /* old adv. API */
-		if(setsockopt(t->sock, IPPROTO_IPV6, IPV6_HOPLIMIT, &opton,
-			      sizeof(opton))) {
-			syslog(LOG_ERR, "setsockopt(IPV6_HOPLIMIT)");
-			close(t->sock);
-			t->sock = -1;
-			return(2);
-		}
+	if(setsockopt(sock, IPPROTO_IPV6, IPV6_HOPLIMIT, &opton,
+		      sizeof(opton))) {
+		syslog(LOG_ERR, "setsockopt(IPV6_HOPLIMIT)");
+		return(2);
+	}
 #endif
 #ifdef IPV6_CHECKSUM
 #ifndef SOL_RAW
 #define SOL_RAW IPPROTO_IPV6
 #endif
-		opton = 2;
+	opton = 2;
 
-		if(setsockopt(t->sock, SOL_RAW, IPV6_CHECKSUM, &opton,
-			      sizeof(opton))) {
-			syslog(LOG_ERR, "setsockopt(SOL_RAW,IPV6_CHECKSUM)");
-			close(t->sock);
-			t->sock = -1;
-			return(2);
-		}
+	if(setsockopt(sock, SOL_RAW, IPV6_CHECKSUM, &opton,
+		      sizeof(opton))) {
+		syslog(LOG_ERR, "setsockopt(SOL_RAW,IPV6_CHECKSUM)");
+		return(2);
+	}
 #endif
+
+	ICMP6_FILTER_SETBLOCKALL(&filter);
+
+	if (setsockopt(sock, SOL_IPV6, IPV6_RECVERR, (char *)&hold, sizeof(hold))) {
+		syslog(LOG_INFO, "WARNING: your kernel is veeery old. No problems.");
+
+		ICMP6_FILTER_SETPASS(ICMP6_DST_UNREACH, &filter);
+		ICMP6_FILTER_SETPASS(ICMP6_PACKET_TOO_BIG, &filter);
+		ICMP6_FILTER_SETPASS(ICMP6_TIME_EXCEEDED, &filter);
+		ICMP6_FILTER_SETPASS(ICMP6_PARAM_PROB, &filter);
+	}
+
+	ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY, &filter);
+
+	if(setsockopt(sock, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof(struct icmp6_filter)) < 0) {
+		syslog(LOG_ERR, "setsockopt(ICMP6_FILTER)");
+		return(2);
+	}
+
+	return(0);
+}
+
+/*
+  Ask for kernel receive timestamps and, where the probe payload can be
+  recognised, software transmit timestamps. RTT is then measured from
+  wire to wire instead of including delays in the main loop. Without
+  them the userspace times are used.
+*/
+static void enable_timestamps(int sock, int tx)
+{
+	int on = 1;
+
+	if(setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == -1) {
+		if(cfg.debug >= 9) syslog(LOG_INFO, "setsockopt(SO_TIMESTAMPNS) failed \"%s\"", strerror(errno));
+	}
+
+	if(tx) {
+		int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+
+		if(setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == -1) {
+			if(cfg.debug >= 9) syslog(LOG_INFO, "setsockopt(SO_TIMESTAMPING) failed \"%s\"", strerror(errno));
+		}
 	}
+}
+
+/*
+  Let the kernel drop everything but echo replies to our own ident, so
+  unrelated ICMP traffic on the host never wakes us up. The id is put
+  on the wire in host byte order, hence the ntohs() for the BPF load
+  which reads network byte order. Failure is not fatal, the userspace
+  checks in handle_reply() still apply.
+*/
+static void attach_icmp_filter(int sock, int pf)
+{
+	unsigned short id = ntohs((unsigned short)get_ident());
+	struct sock_filter insns4[] = {
+		BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),                 /* x = ip header length */
+		BPF_STMT(BPF_LD | BPF_B | BPF_IND, 0),                  /* icmp type */
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHOREPLY, 0, 3),
+		BPF_STMT(BPF_LD | BPF_H | BPF_IND, 4),                  /* icmp id */
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, id, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	struct sock_filter insns6[] = {
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),                  /* icmp6 type */
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP6_ECHO_REPLY, 0, 3),
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 4),                  /* icmp6 id */
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, id, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	struct sock_fprog prog;
 
 	if(pf == AF_INET6) {
-		int hold = 1;
+		prog.len = sizeof(insns6) / sizeof(insns6[0]);
+		prog.filter = insns6;
+	} else {
+		prog.len = sizeof(insns4) / sizeof(insns4[0]);
+		prog.filter = insns4;
+	}
 
-		ICMP6_FILTER_SETBLOCKALL(&t->filter);
+	if(setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) == -1) {
+		syslog(LOG_INFO, "WARNING: failed to attach icmp filter \"%s\"", strerror(errno));
+	}
+}
+
+static int open_icmp_sock(CONFIG *cur)
+{
+	TARGET *t = (TARGET *)cur->data;
+	struct protoent *proto;
+	int pf = cur->dstinfo->ai_family;
 
-		if (setsockopt(t->sock, SOL_IPV6, IPV6_RECVERR, (char *)&hold, sizeof(hold))) {
-			syslog(LOG_INFO, "WARNING: your kernel is veeery old. No problems.");
+	if(t->sock != -1) return(0);
+
+	if(cur->shared_socket && !cur->ping_socket) return(open_shared_icmp_sock(cur));
 
-			ICMP6_FILTER_SETPASS(ICMP6_DST_UNREACH, &t->filter);
-			ICMP6_FILTER_SETPASS(ICMP6_PACKET_TOO_BIG, &t->filter);
-			ICMP6_FILTER_SETPASS(ICMP6_TIME_EXCEEDED, &t->filter);
-			ICMP6_FILTER_SETPASS(ICMP6_PARAM_PROB, &t->filter);
+	if(pf == AF_INET6) {
+		if((proto = getprotobyname("ipv6-icmp")) == NULL) {
+			syslog(LOG_ERR, "no ipv6-icmp proto found");
+			return(1);
+		}
+	} else {
+		if((proto = getprotobyname("icmp")) == NULL) {
+			syslog(LOG_ERR, "no icmp proto found");
+			return(1);
 		}
+	}
 
-		ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY, &t->filter);
+	/* ping sockets need no privileges, only a matching net.ipv4.ping_group_range */
+	t->sock = socket(pf, cur->ping_socket ? SOCK_DGRAM : SOCK_RAW, proto->p_proto);
+
+	if(t->sock < 0) {
+		syslog(LOG_ERR, "could not open %ssocket for ping target \"%s\" reason \"%s\"\n", cur->ping_socket ? "ping " : "", cur->name, strerror(errno));
+		t->sock = -1;
+		return(1);
+	}
+	if(fcntl(t->sock, F_SETFD, FD_CLOEXEC) == -1) {
+		syslog(LOG_ERR, "failed to set close on exec on socket %s reason \"%s\"", cur->name, strerror(errno));
+	}
+	if(poll_add_sock(cur) != 0) return(1);
 
-		if(setsockopt(t->sock, IPPROTO_ICMPV6, ICMP6_FILTER, &t->filter, sizeof(struct icmp6_filter)) < 0) {
-			syslog(LOG_ERR, "setsockopt(ICMP6_FILTER)");
+	/* checksum, type filtering and demultiplexing are done by the kernel on ping sockets */
+	if(!cur->ping_socket) {
+		if(pf == AF_INET6 && icmp6_sock_opts(t->sock) != 0) {
+			close_sock(t);
 			return(2);
 		}
+		attach_icmp_filter(t->sock, pf);
 	}
+	enable_timestamps(t->sock, 1);
 
 	if(cur->ttl) {
 		if(pf == AF_INET6) {
 			if(setsockopt(t->sock, IPPROTO_IPV6, IPV6_MULTICAST_HOPS,
 				       &cur->ttl, sizeof(cur->ttl)) == -1) {
 				syslog(LOG_ERR, "can't set multicast hop limit \"%s\"", strerror(errno));
-				close(t->sock);
-				t->sock = -1;
+				close_sock(t);
 				return(2);
 			}
 			if(setsockopt(t->sock, IPPROTO_IPV6, IPV6_UNICAST_HOPS,
 				       &cur->ttl, sizeof(cur->ttl)) == -1) {
 				syslog(LOG_ERR, "can't set unicast hop limit \"%s\"", strerror(errno));
-				close(t->sock);
-				t->sock = -1;
+				close_sock(t);
 				return(2);
 			}
 		} else if(pf == AF_INET) { /* AF_INET */
@@ -1936,15 +2909,13 @@ static int open_icmp_sock(CONFIG *cur)
 			if(setsockopt(t->sock, IPPROTO_IP, IP_MULTICAST_TTL,
 			      &cur->ttl, 1) == -1) {
 				syslog(LOG_ERR, "can't set multicast time-to-live \"%s\"", strerror(errno));
-				close(t->sock);
-				t->sock = -1;
+				close_sock(t);
 				return(2);
 			}
 			if(setsockopt(t->sock, IPPROTO_IP, IP_TTL,
 				      &ittl, sizeof(ittl)) == -1) {
 				syslog(LOG_ERR, "can't set unicast time-to-live \"%s\"", strerror(errno));
-				close(t->sock);
-				t->sock = -1;
+				close_sock(t);
 				return(2);
 			}
 		}
@@ -1955,8 +2926,7 @@ static int open_icmp_sock(CONFIG *cur)
 	if(pf == AF_INET && cur->device && *cur->device && !strchr(cur->device,':')) {
 		if(setsockopt(t->sock, SOL_SOCKET, SO_BINDTODEVICE, cur->device, strlen(cur->device) + 1) == -1) {
 			syslog(LOG_INFO, "failed to bind to ping interface device \"%s\", \"%s\"", cur->device, strerror(errno));
-			close(t->sock);
-			t->sock = -1;
+			close_sock(t);
 			return(2);
 		}
 	}
@@ -1965,8 +2935,7 @@ static int open_icmp_sock(CONFIG *cur)
 	if(cfg.debug >= 9) syslog(LOG_INFO, "%s: %s: probing for src ip for %s", __FILE__, __FUNCTION__, cur->name);
 #endif
 	if(probe_src_ip_addr(cur) != 0) {
-		close(t->sock);
-		t->sock = -1;
+		close_sock(t);
 		return(2);
 	}
 #if defined(DEBUG)
@@ -2017,11 +2986,11 @@ static int open_icmp_sock(CONFIG *cur)
 			return(2);
 		}
 
-		memset(&t->cmsgbuf, 0, sizeof(t->cmsgbuf));
-		t->cmsglen = 0;
+		memset(&t->cold->cmsgbuf, 0, sizeof(t->cold->cmsgbuf));
+		t->cold->cmsglen = 0;
 
-		cmsg = (struct cmsghdr *)t->cmsgbuf;
-		t->cmsglen += CMSG_SPACE(sizeof(*ipi));
+		cmsg = (struct cmsghdr *)t->cold->cmsgbuf;
+		t->cold->cmsglen += CMSG_SPACE(sizeof(*ipi));
 		cmsg->cmsg_len = CMSG_LEN(sizeof(*ipi));
 		cmsg->cmsg_level = SOL_IPV6;
 		cmsg->cmsg_type = IPV6_PKTINFO;
@@ -2034,6 +3003,136 @@ static int open_icmp_sock(CONFIG *cur)
 	return(0);
 }
 
+/*
+  Connections with shared_socket set use one raw socket per protocol
+  family instead of one each. Source address, interface and ttl are
+  passed with every packet as ancillary data, so the socket is never
+  bound, and replies are told apart by the target id in the payload.
+*/
+static int open_shared_icmp_sock(CONFIG *cur)
+{
+	TARGET *t = (TARGET *)cur->data;
+	int pf = cur->dstinfo->ai_family;
+	SHARED_SOCK *ss = (pf == AF_INET6) ? &shared_icmp6 : &shared_icmp4;
+
+	if(ss->sock == -1) {
+		struct protoent *proto;
+		int sock;
+
+		if((proto = getprotobyname(pf == AF_INET6 ? "ipv6-icmp" : "icmp")) == NULL) {
+			syslog(LOG_ERR, "no %s proto found", pf == AF_INET6 ? "ipv6-icmp" : "icmp");
+			return(1);
+		}
+
+		if((sock = socket(pf, SOCK_RAW, proto->p_proto)) < 0) {
+			syslog(LOG_ERR, "could not open shared %s socket reason \"%s\"", pf == AF_INET6 ? "ipv6" : "ipv4", strerror(errno));
+			return(1);
+		}
+		if(fcntl(sock, F_SETFD, FD_CLOEXEC) == -1) {
+			syslog(LOG_ERR, "failed to set close on exec on shared socket reason \"%s\"", strerror(errno));
+		}
+
+		if(pf == AF_INET6 && icmp6_sock_opts(sock) != 0) {
+			close(sock);
+			return(2);
+		}
+		attach_icmp_filter(sock, pf);
+		enable_timestamps(sock, 1);
+
+		if(poll_add(sock, ss)) {
+			syslog(LOG_ERR, "failed to watch shared socket");
+			close(sock);
+			return(1);
+		}
+
+		ss->sock = sock;
+		ss->users = 0;
+	}
+
+	t->sock = ss->sock;
+	ss->users++;
+
+	if(probe_src_ip_addr(cur) != 0 || set_pktinfo(cur) != 0) {
+		close_sock(t);
+		return(2);
+	}
+
+	return(0);
+}
+
+/*
+  Fill the connection control message buffer with the packet info and
+  hop limit used on the shared socket.
+*/
+static int set_pktinfo(CONFIG *cur)
+{
+	TARGET *t = (TARGET *)cur->data;
+	struct cmsghdr *cmsg;
+	int ifindex = 0;
+	int ttl = cur->ttl;
+
+	if(cur->device && *cur->device) {
+		struct ifreq ifr;
+
+		memset(&ifr, 0, sizeof(ifr));
+		strncpy(ifr.ifr_name, cur->device, IFNAMSIZ-1);
+		if(ioctl(t->sock, SIOCGIFINDEX, &ifr) < 0) {
+			syslog(LOG_ERR, "connection %s unknown iface %s", cur->name, cur->device);
+			return(2);
+		}
+		ifindex = ifr.ifr_ifindex;
+	}
+
+	memset(t->cold->cmsgbuf, 0, sizeof(t->cold->cmsgbuf));
+	t->cold->cmsglen = 0;
+
+	cmsg = (struct cmsghdr *)t->cold->cmsgbuf;
+
+	if(cur->dstinfo->ai_family == AF_INET6) {
+		struct in6_pktinfo *ipi;
+
+		cmsg->cmsg_len = CMSG_LEN(sizeof(*ipi));
+		cmsg->cmsg_level = SOL_IPV6;
+		cmsg->cmsg_type = IPV6_PKTINFO;
+
+		ipi = (struct in6_pktinfo *)CMSG_DATA(cmsg);
+		ipi->ipi6_addr = t->cold->src6;
+		ipi->ipi6_ifindex = ifindex;
+		t->cold->cmsglen += CMSG_SPACE(sizeof(*ipi));
+
+		if(ttl) {
+			cmsg = (struct cmsghdr *)(t->cold->cmsgbuf + t->cold->cmsglen);
+			cmsg->cmsg_len = CMSG_LEN(sizeof(ttl));
+			cmsg->cmsg_level = SOL_IPV6;
+			cmsg->cmsg_type = IPV6_HOPLIMIT;
+			memcpy(CMSG_DATA(cmsg), &ttl, sizeof(ttl));
+			t->cold->cmsglen += CMSG_SPACE(sizeof(ttl));
+		}
+	} else {
+		struct in_pktinfo *ipi;
+
+		cmsg->cmsg_len = CMSG_LEN(sizeof(*ipi));
+		cmsg->cmsg_level = SOL_IP;
+		cmsg->cmsg_type = IP_PKTINFO;
+
+		ipi = (struct in_pktinfo *)CMSG_DATA(cmsg);
+		ipi->ipi_ifindex = ifindex;
+		ipi->ipi_spec_dst = t->cold->src;
+		t->cold->cmsglen += CMSG_SPACE(sizeof(*ipi));
+
+		if(ttl) {
+			cmsg = (struct cmsghdr *)(t->cold->cmsgbuf + t->cold->cmsglen);
+			cmsg->cmsg_len = CMSG_LEN(sizeof(ttl));
+			cmsg->cmsg_level = SOL_IP;
+			cmsg->cmsg_type = IP_TTL;
+			memcpy(CMSG_DATA(cmsg), &ttl, sizeof(ttl));
+			t->cold->cmsglen += CMSG_SPACE(sizeof(ttl));
+		}
+	}
+
+	return(0);
+}
+
 static int probe_src_ip_addr(CONFIG *cur)
 { /* probe for src ip address */
 	TARGET *t = (TARGET *)cur->data;
@@ -2059,13 +3158,13 @@ static int probe_src_ip_addr(CONFIG *cur)
 		struct sockaddr_in saddr;
 		memset(&saddr, 0, sizeof(saddr));
 		saddr.sin_family = AF_INET;
-		if(t->src.s_addr) {
-			saddr.sin_addr = t->src;
+		if(t->cold->src.s_addr) {
+			saddr.sin_addr = t->cold->src;
 			if(bind(probe_fd, (struct sockaddr*)&saddr, sizeof(saddr)) == -1) {
 				syslog(LOG_ERR, "ping probe bind failed for %s \"%s\"", cur->name, strerror(errno));
 				close(probe_fd);
 				/* earlier probed src addr is not usable, wipe it */
-				memset(&t->src, 0, sizeof(t->src));
+				memset(&t->cold->src, 0, sizeof(t->cold->src));
 				return(2);
 			}
 		} else {
@@ -2078,7 +3177,7 @@ static int probe_src_ip_addr(CONFIG *cur)
                     syslog(LOG_ERR,"ioctl probe of current ip address for device %s failed \"%s\"",cur->device,strerror(errno));
                     return(2);
                   }
-                  t->src = ((struct sockaddr_in*) &ifr.ifr_addr)->sin_addr;
+                  t->cold->src = ((struct sockaddr_in*) &ifr.ifr_addr)->sin_addr;
                 }
 		/*
 		  else {
@@ -2086,7 +3185,7 @@ static int probe_src_ip_addr(CONFIG *cur)
 			int alen = sizeof(saddr);
 
 			saddr.sin_port = htons(1025);
-			saddr.sin_addr = t->dst;
+			saddr.sin_addr = t->cold->dst;
 
 			if(setsockopt(probe_fd, SOL_SOCKET, SO_DONTROUTE, (char*)&on, sizeof(on)) == -1)
 				syslog(LOG_INFO, "WARNING: ping probe setsockopt(SO_DONTROUTE) \"%s\"", strerror(errno));
@@ -2100,7 +3199,7 @@ static int probe_src_ip_addr(CONFIG *cur)
 				close(probe_fd);
 				return(2);
 			}
-			t->src = saddr.sin_addr;
+			t->cold->src = saddr.sin_addr;
 		}
 		*/
 	} else if (pf == AF_INET6) { /* not AF_INET */
@@ -2109,13 +3208,13 @@ static int probe_src_ip_addr(CONFIG *cur)
 
 		memset(&saddr, 0, sizeof(saddr));
 		saddr.sin6_family = AF_INET6;
-		if(memcmp(&t->src6, nulladdr, sizeof(t->src6)) != 0) { /* is not null addr */
-			memcpy(&saddr.sin6_addr, &t->src6, sizeof(t->src6));
+		if(memcmp(&t->cold->src6, nulladdr, sizeof(t->cold->src6)) != 0) { /* is not null addr */
+			memcpy(&saddr.sin6_addr, &t->cold->src6, sizeof(t->cold->src6));
 			if(bind(probe_fd, (struct sockaddr *)&saddr, sizeof(saddr)) == -1) {
 				syslog(LOG_ERR, "ping6 probe bind failed for %s \"%s\"", cur->name,strerror(errno));
 				close(probe_fd);
 				/* earlier probed src addr is not usable, wipe it */
-				memset(&t->src6, 0, sizeof(t->src6));
+				memset(&t->cold->src6, 0, sizeof(t->cold->src6));
 				return(2);
 			}
 		} else { /* is null addr */
@@ -2123,7 +3222,7 @@ static int probe_src_ip_addr(CONFIG *cur)
 
 			saddr.sin6_port = htons(1025);
 			saddr.sin6_family = cur->dstinfo->ai_family;
-			memcpy(&saddr.sin6_addr, &t->dst6, sizeof(t->dst6));
+			memcpy(&saddr.sin6_addr, &t->cold->dst6, sizeof(t->cold->dst6));
 #if 0
 			if(setsockopt(probe_fd, SOL_SOCKET, SO_DONTROUTE, (char *)&on, sizeof(on)) == -1)
 				syslog(LOG_INFO, "WARNING: ping6 probe setsockopt(SO_DONTROUTE) for %s \"%s\"", cur->name, strerror(errno));
@@ -2138,7 +3237,7 @@ static int probe_src_ip_addr(CONFIG *cur)
 				close(probe_fd);
 				return(2);
 			}
-			memcpy(&t->src6, &saddr.sin6_addr, sizeof(saddr.sin6_addr));
+			memcpy(&t->cold->src6, &saddr.sin6_addr, sizeof(saddr.sin6_addr));
 		}
 	} /* if AF_INET */
 
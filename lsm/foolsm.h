@@ -9,32 +9,41 @@ License: GPLv2
 #ifndef __FOOLSM_H__
 #define __FOOLSM_H__
 
+#include <stdint.h>
+#include <sys/socket.h> /* for CMSG_SPACE */
 #include <netinet/in.h> /* for struct sockaddr_in */
 #include <linux/if_arp.h> /* for struct sockadd_ll */
 #include <netinet/icmp6.h> /* for struct icmp6_filter */
 
 #include "defs.h"
+#include "rttstat.h"
+#include "losswin.h"
 
-typedef struct sentpkt {
-	unsigned short seq;
-	struct timeval sent_time;
-	struct timeval replied_time;
-	unsigned long rtt;
-	struct {
-		unsigned replied:1;
-		unsigned timeout:1;
-		unsigned waiting:1;
-		unsigned used:1;
-		unsigned error:1;
-	} flags;
-} SENTPKT;
+#define HIST_WORDS(n) (((n) + 63) / 64)
 
-typedef struct target {
-	unsigned short id; /* target id */
-	unsigned short seq;
-	unsigned short downseq;
-	unsigned short downseqreported;
-	struct timeval down_timestamp;
+#define BIT_TEST(v, i) (((v)[(i) / 64] >> ((i) % 64)) & 1)
+#define BIT_SET(v, i)  ((v)[(i) / 64] |= 1ULL << ((i) % 64))
+#define BIT_CLR(v, i)  ((v)[(i) / 64] &= ~(1ULL << ((i) % 64)))
+
+/*
+  probe history, slot i of the window is bit i of each vector. The
+  storage is sized by the followed_pkts of the connection.
+*/
+typedef struct history {
+	uint64_t *used;
+	uint64_t *replied;
+	uint64_t *waiting;
+	uint64_t *timeout;
+	uint64_t *error;
+	int64_t *sent_time; /* monotonic ns */
+	uint32_t *rtt;      /* usec */
+} HISTORY;
+
+/* room for IPV6_PKTINFO and IPV6_HOPLIMIT, the ipv4 ones are smaller */
+#define CMSG_BUFLEN (CMSG_SPACE(sizeof(struct in6_addr) + sizeof(unsigned int)) + CMSG_SPACE(sizeof(int)))
+
+/* per connection state needed only when a probe is built or a reply matched */
+typedef struct target_cold {
 	struct sockaddr_in src_addr;
 	struct sockaddr_in dst_addr;
 	struct sockaddr_in6 src_addr6;
@@ -45,14 +54,34 @@ typedef struct target {
 	struct in_addr dst;
 	struct in6_addr src6;
 	struct in6_addr dst6;
-	unsigned long num_sent;
-	struct timeval last_send_time;
+	unsigned char cmsgbuf[CMSG_BUFLEN];
+	int cmsglen;
+	HISTORY hist;
+	RTT_HIST rtt_hist; /* rtts of the replied pkts in hist */
+	LOSS_WIN loss_win; /* outcomes over the last loss_window_s */
+	RTT_STATS rtt;     /* from rtt_hist, refreshed on the decision tick */
+	GROUPS **groups;   /* the groups the connection is a member of */
+	int ngroups;
+} TARGET_COLD;
+
+/*
+  What the scheduler, timeout and decision passes look at. These are
+  kept in one array indexed by id so a pass over all connections stays
+  within a few cache lines each, 160 bytes on 64 bit, so about 160KB
+  for 1000 connections. A reply also updates rtt_hist and loss_win in
+  the cold part.
+*/
+typedef struct target {
+	unsigned short id; /* target id */
+	unsigned short seq;
+	unsigned short downseq;
+	unsigned short downseqreported;
+	unsigned short tmo_seq; /* oldest pkt not yet checked for timeout */
 	STATUS status;
 	int sock;
-	unsigned char cmsgbuf[4096];
-	int cmsglen;
-	struct icmp6_filter filter;
-	SENTPKT sentpkts[FOLLOWED_PKTS];
+	int sched_idx;
+	int tmo_idx;
+	int status_change;
 	int timeout;
 	int timeout_max;
 	int replied;
@@ -63,8 +92,18 @@ typedef struct target {
 	int consecutive_missing;
 	int consecutive_missing_max;
 	int consecutive_rcvd;
+	int window;    /* pkts followed, the size of hist */
+	int seq_limit; /* seq wraps here, a multiple of window */
+	unsigned long num_sent;
+	int64_t next_send;
+	int64_t tmo_at; /* when the pkt at tmo_seq may time out */
+	int64_t down_timestamp;
+	int64_t silent_since;   /* first send not answered since the last reply, 0 after a reply */
+	int64_t replying_since; /* first reply not followed by a timeout, 0 after a timeout */
+	int loss_pct;           /* over loss_win */
+	long long rtt_sum; /* usec, of the replied pkts in hist */
 	long avg_rtt;
-	int status_change;
+	TARGET_COLD *cold;
 } TARGET;
 
 #endif
@@ -16,53 +16,78 @@ License: GPLv2
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/signalfd.h>
+#include <signal.h>
 
 #include "config.h"
 #include "forkexec.h"
+#include "spawn.h"
+#include "timecalc.h"
 
-static void sigchld_hdl(int sig);
+#define EXEC_HASH_SIZE (64) /* buckets of the name and job indexes, a power of two */
 
 typedef struct exec_queue
 {
-	pid_t pid;
+	int job; /* spawn job, 0 while not started */
 	char **argv;
 	char **envp;
+	struct exec_queues *owner;
+	int64_t queued_at;
+	int64_t started_at;
+	int signalled; /* last signal sent past the deadline */
 	struct exec_queue *next;
+	struct exec_queue *prev; /* in the running list */
+	struct exec_queue *jnext; /* next in the job index bucket */
 } EXEC_QUEUE;
 
 typedef struct exec_queues
 {
 	char *name;
-	EXEC_QUEUE *first;
+	EXEC_QUEUE *first; /* waiting to run, oldest first */
 	EXEC_QUEUE *last;
+	EXEC_QUEUE *running;
+	int depth;
+	int nrunning;
+
+	/* from the queue block */
+	int max_running;
+	int64_t deadline;
+	int64_t kill_grace;
+	int max_depth;
+	int drop_oldest;
+
+	unsigned long started, finished, dropped, killed;
+	int64_t wait_sum, wait_max;
+	int64_t run_sum, run_max;
+
 	struct exec_queues *next;
+	struct exec_queues *hnext; /* next in the name index bucket */
 } EXEC_QUEUES;
 
+typedef struct exec_batch
+{
+	char *queue;
+	int n, max;
+	char ***argvs; /* argv of every event collected for the script */
+} EXEC_BATCH;
+
 static EXEC_QUEUES *exec_queues_first = NULL;
 static EXEC_QUEUES *exec_queues_last = NULL;
-
-pid_t forkexec(char **argv, char **envp)
+static EXEC_QUEUES *exec_queue_names[EXEC_HASH_SIZE]; /* queues by name */
+static EXEC_QUEUE *exec_queue_jobs[EXEC_HASH_SIZE]; /* running scripts by job */
+static int sigchld_fd = -1;
+static char **exec_envp = NULL;
+static EXEC_BATCH *exec_batches = NULL;
+static int exec_nbatches = 0;
+static int exec_maxbatches = 0;
+
+/* scripts are started by the spawn helper, returns the job number or 0 on failure */
+int forkexec(char **argv, char **envp)
 {
-	pid_t pid;
+	int job;
 #if defined(DEBUG)
 	int i;
-#endif
-
-	if((pid = fork()) == -1) {
-		syslog(LOG_ERR, "%s: %s: %d: fork() failed \"%s\"", __FILE__, __FUNCTION__, __LINE__, strerror(errno));
-		return(0);
-	}
-
-	if(pid) {
-		/* parent */
-		if(cfg.debug >= 9) syslog(LOG_INFO, "%s: %s: %d: child process forked with pid: %d", __FILE__, __FUNCTION__, __LINE__, pid);
-		return(pid);
-	}
-
-	/* child */
-	closelog(); /* openlog doesn't return a fd to set close on exec */
 
-#if defined(DEBUG)
 	for(i = 0; argv[i]; i++) {
 		fprintf(stderr, "argv[%d] = \"%s\"\n", i, argv[i]);
 	}
@@ -71,57 +96,100 @@ pid_t forkexec(char **argv, char **envp)
 	}
 #endif
 
-	execve(argv[0], argv, envp);
-	syslog(LOG_ERR, "%s: %s: %d: child process failed to execute external command", __FILE__, __FUNCTION__, __LINE__);
-	exit(1); /* exec failed ... */
+	if((job = spawn_job(argv, envp)) == 0) {
+		syslog(LOG_ERR, "%s: %s: %d: failed to hand %s over to the script spawner", __FILE__, __FUNCTION__, __LINE__, argv[0]);
+		return(0);
+	}
+
+	if(cfg.debug >= 9) syslog(LOG_INFO, "%s: %s: %d: child process queued as job: %d", __FILE__, __FUNCTION__, __LINE__, job);
+
+	return(job);
 }
 
 /*
-  Set up child signal handler to handle termination of children.
-  This should be done once only for the main program.
+  Children of ours are reaped from the main loop. SIGCHLD is blocked
+  and read through a signalfd, so nothing runs in signal context.
+  Scripts are children of the spawn helper, so the only child of ours
+  to reap is the helper itself.
 */
-void create_sigchld_hdl(void)
+void create_sigchld_fd(void)
 {
-	struct sigaction act;
-
-	memset (&act, 0, sizeof(act));
-	act.sa_handler = sigchld_hdl;
-	sigemptyset(&act.sa_mask);
-	act.sa_flags = SA_RESTART | SA_NOCLDSTOP;
-	if (sigaction(SIGCHLD, &act, 0)) {
-		syslog(LOG_ERR, "%s: %s: %d: failed to set up child signal handler: %s", __FILE__, __FUNCTION__, __LINE__, strerror(errno));
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+
+	if(sigprocmask(SIG_BLOCK, &mask, NULL) == -1 || (sigchld_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+		syslog(LOG_ERR, "%s: %s: %d: failed to set up child signal fd: %s", __FILE__, __FUNCTION__, __LINE__, strerror(errno));
 		return;
-	} else {
-		if(cfg.debug >= 9) syslog(LOG_INFO, "%s: %s: %d: successfully set up child signal handler", __FILE__, __FUNCTION__, __LINE__);
 	}
+
+	if(cfg.debug >= 9) syslog(LOG_INFO, "%s: %s: %d: successfully set up child signal fd", __FILE__, __FUNCTION__, __LINE__);
 }
 
-/*
-  SIGCHLD handler. Will be called for all children.
-*/
-static void sigchld_hdl(int sig)
+/* collect exited children, costs one read while there are none */
+void reap_children(void)
 {
-	/* Wait for the dead process.
-	 * We use a non-blocking call to be sure this signal handler will not
-	 * block if a child was cleaned up in another part of the program. */
-	int saved_errno = errno;
-	int script_status;
+	struct signalfd_siginfo si;
+	int status, got = 0;
 	pid_t pid;
 
-	while ((pid = waitpid(WAIT_ANY, &script_status, WNOHANG)) != 0) {
-		if(pid == -1) {
-			if(cfg.debug >= 9 && errno != ECHILD)
-				syslog(LOG_ERR, "%s: %s: %d: waitpid failed %s", __FILE__, __FUNCTION__, __LINE__, strerror(errno));
-			break;
-		} else {
-			if(cfg.debug >= 9 && WEXITSTATUS(script_status))
-				syslog(LOG_ERR, "%s: %s: %d: child script with pid %d exited with non null exit value %d", __FILE__, __FUNCTION__, __LINE__, pid, WEXITSTATUS(script_status));
-			else if(cfg.debug >= 9)
-				syslog(LOG_ERR, "%s: %s: %d: child script with pid %d exited successfully", __FILE__, __FUNCTION__, __LINE__, pid);
-			exec_queue_delete(pid);
-		}
+	if(sigchld_fd == -1) return;
+
+	while(read(sigchld_fd, &si, sizeof(si)) == sizeof(si)) got = 1;
+
+	if(!got) return;
+
+	while((pid = waitpid(WAIT_ANY, &status, WNOHANG)) > 0) {
+		if(cfg.debug >= 9) syslog(LOG_INFO, "%s: %s: %d: child with pid %d exited", __FILE__, __FUNCTION__, __LINE__, pid);
+		spawn_child_exited(pid);
+	}
+}
+
+void close_sigchld_fd(void)
+{
+	if(sigchld_fd != -1) close(sigchld_fd);
+	sigchld_fd = -1;
+}
+
+static unsigned int exec_queue_hash(const char *name)
+{
+	unsigned int h = 5381;
+
+	while(*name) h = h * 33 + (unsigned char)*name++;
+
+	return(h & (EXEC_HASH_SIZE - 1));
+}
+
+static EXEC_QUEUES *exec_queue_find(const char *name)
+{
+	EXEC_QUEUES *eqs;
+
+	for(eqs = exec_queue_names[exec_queue_hash(name)]; eqs; eqs = eqs->hnext) {
+		if(!strcmp(eqs->name, name)) return(eqs);
 	}
-	errno = saved_errno;
+
+	return(NULL);
+}
+
+/* take the settings of a queue from its queue block */
+static void exec_queue_settings(EXEC_QUEUES *eqs)
+{
+	QUEUE_CFG *qc = find_queue_config(eqs->name);
+
+	eqs->max_running = qc->max_running;
+	eqs->deadline = (int64_t)qc->deadline_ms * NSEC_PER_MSEC;
+	eqs->kill_grace = (int64_t)qc->kill_grace_ms * NSEC_PER_MSEC;
+	eqs->max_depth = qc->max_depth;
+	eqs->drop_oldest = qc->drop_oldest;
+}
+
+/* after a config reload */
+void exec_queue_configure(void)
+{
+	EXEC_QUEUES *eqs;
+
+	for(eqs = exec_queues_first; eqs; eqs = eqs->next) exec_queue_settings(eqs);
 }
 
 void exec_queue_add(char *queue, char **argv, char **envp)
@@ -129,86 +197,79 @@ void exec_queue_add(char *queue, char **argv, char **envp)
 	EXEC_QUEUES *eqs;
 	EXEC_QUEUE *eq;
 
-	if(!exec_queues_first) { /* first queue */
-		if((eqs = malloc(sizeof(EXEC_QUEUES))) == NULL) {
+	if((eqs = exec_queue_find(queue)) != NULL) {
+		if(cfg.debug >= 9) syslog(LOG_INFO, "%s: %s: %d: found queue %s", __FILE__, __FUNCTION__, __LINE__, eqs->name);
+
+	} else { /* not found, create a new queue and add to it */
+		unsigned int h = exec_queue_hash(queue);
+
+		if(cfg.debug >= 9) syslog(LOG_INFO, "%s: %s: %d: queue %s not found adding new queue", __FILE__, __FUNCTION__, __LINE__, queue);
+
+		if((eqs = calloc(1, sizeof(EXEC_QUEUES))) == NULL) {
 			syslog(LOG_ERR, "%s: %s: %d: malloc failed %s", __FILE__, __FUNCTION__, __LINE__, strerror(errno));
+			exec_queue_argv_free(argv);
 			return;
 		}
 		eqs->name = strdup(queue);
-		eqs->next = NULL;
+		exec_queue_settings(eqs);
+		eqs->hnext = exec_queue_names[h];
+		exec_queue_names[h] = eqs;
 
-		if((eq = malloc(sizeof(EXEC_QUEUE))) == NULL) {
-			syslog(LOG_ERR, "%s: %s: %d: malloc failed %s", __FILE__, __FUNCTION__, __LINE__, strerror(errno));
-			return;
+		if(!exec_queues_first) { /* first queue */
+			exec_queues_first = eqs;
+		} else {
+			exec_queues_last->next = eqs;
 		}
-		eq->pid = 0;
-		eq->argv = argv;
-		eq->envp = envp;
-		eq->next = NULL;
-
-		eqs->first = eq;
-		eqs->last = eq;
-
-		exec_queues_first = eqs;
 		exec_queues_last = eqs;
+	}
 
-	} else { /* not first queue */
-		for(eqs = exec_queues_first; eqs; eqs = eqs->next) {
-			if(!strcmp(eqs->name, queue)) {
-				/* queue exists, add to it */
-				if(cfg.debug >= 9) syslog(LOG_INFO, "%s: %s: %d: found queue %s", __FILE__, __FUNCTION__, __LINE__, eqs->name);
-
-				if((eq = malloc(sizeof(EXEC_QUEUE))) == NULL) {
-					syslog(LOG_ERR, "%s: %s: %d: malloc failed %s", __FILE__, __FUNCTION__, __LINE__, strerror(errno));
-					return;
-				}
-
-				eq->pid = 0;
-				eq->argv = argv;
-				eq->envp = envp;
-				eq->next = NULL;
-
-				if(!eqs->first) { /* empty queue */
-					eqs->first = eq;
-					eqs->last = eq;
+	/* a full queue gives up its oldest waiting script or the new one */
+	if(eqs->max_depth && eqs->depth >= eqs->max_depth) {
+		eqs->dropped++;
 
-				} else { /* add after last */
-					eqs->last->next = eq;
-					eqs->last = eq;
-				}
-
-				break;
-			}
+		if(!eqs->drop_oldest) {
+			syslog(LOG_WARNING, "queue %s is full with %d scripts waiting, dropping %s", eqs->name, eqs->depth, argv[0]);
+			exec_queue_argv_free(argv);
+			return;
 		}
 
-		if(!eqs) { /* not found, create a new queue and add to it */
-			if(cfg.debug >= 9) syslog(LOG_INFO, "%s: %s: %d: queue %s not found adding new queue", __FILE__, __FUNCTION__, __LINE__, queue);
+		eq = eqs->first;
+		syslog(LOG_WARNING, "queue %s is full with %d scripts waiting, dropping the oldest %s", eqs->name, eqs->depth, eq->argv[0]);
 
-			if((eqs = malloc(sizeof(EXEC_QUEUES))) == NULL) {
-				syslog(LOG_ERR, "%s: %s: %d: malloc failed %s", __FILE__, __FUNCTION__, __LINE__, strerror(errno));
-				return;
-			}
-			eqs->name = strdup(queue);
-			eqs->next = NULL;
+		eqs->first = eq->next;
+		if(!eqs->first) eqs->last = NULL;
+		eqs->depth--;
 
-			exec_queues_last->next = eqs;
-			exec_queues_last = eqs;
+		exec_queue_argv_free(eq->argv);
+		free(eq);
+	}
 
-			if((eq = malloc(sizeof(EXEC_QUEUE))) == NULL) {
-				syslog(LOG_ERR, "%s: %s: %d: malloc failed %s", __FILE__, __FUNCTION__, __LINE__, strerror(errno));
-				return;
-			}
+	if((eq = malloc(sizeof(EXEC_QUEUE))) == NULL) {
+		syslog(LOG_ERR, "%s: %s: %d: malloc failed %s", __FILE__, __FUNCTION__, __LINE__, strerror(errno));
+		exec_queue_argv_free(argv);
+		return;
+	}
 
-			eq->pid = 0;
-			eq->argv = argv;
-			eq->envp = envp;
-			eq->next = NULL;
+	eq->job = 0;
+	eq->argv = argv;
+	eq->envp = envp;
+	eq->owner = eqs;
+	eq->queued_at = nstime_now();
+	eq->started_at = 0;
+	eq->signalled = 0;
+	eq->next = NULL;
+	eq->prev = NULL;
+	eq->jnext = NULL;
+
+	if(!eqs->first) { /* empty queue */
+		eqs->first = eq;
+		eqs->last = eq;
 
-			eqs->first = eq;
-			eqs->last = eq;
-		}
+	} else { /* add after last */
+		eqs->last->next = eq;
+		eqs->last = eq;
 	}
-	return;
+	eqs->depth++;
 }
 
 #if defined(DEBUG)
@@ -221,8 +282,10 @@ void exec_queue_dump(void)
 
 	for(eqs = exec_queues_first; eqs; eqs = eqs->next) {
 		syslog(LOG_INFO, "%s: %s: %d: eqs->name %s", __FILE__, __FUNCTION__, __LINE__, eqs->name);
+		for(eq = eqs->running; eq; eq = eq->next) {
+			syslog(LOG_INFO, "%s: %s: %d: running eq->job %d", __FILE__, __FUNCTION__, __LINE__, eq->job);
+		}
 		for(eq = eqs->first; eq; eq = eq->next) {
-			syslog(LOG_INFO, "%s: %s: %d: eq->pid %d", __FILE__, __FUNCTION__, __LINE__, eq->pid);
 			for(i = 0; eq->argv[i]; i++) {
 				syslog(LOG_INFO, "%s: %s: %d: argv[%d] = %s", __FILE__, __FUNCTION__, __LINE__, i, eq->argv[i]);
 			}
@@ -231,82 +294,289 @@ void exec_queue_dump(void)
 }
 #endif
 
-void exec_queue_process(void)
+/* counters of every queue, on SIGUSR1 */
+void exec_queue_stats(void)
 {
 	EXEC_QUEUES *eqs;
-	EXEC_QUEUE *eq;
 
 	for(eqs = exec_queues_first; eqs; eqs = eqs->next) {
-		eq = eqs->first;
-		if(eq && eq->pid == 0) eq->pid = forkexec(eq->argv, eq->envp);
+		syslog(LOG_INFO, "queue %s: waiting = %d, running = %d, started = %lu, finished = %lu, dropped = %lu, killed = %lu, wait avg/max = %.3f/%.3f s, run avg/max = %.3f/%.3f s",
+		       eqs->name, eqs->depth, eqs->nrunning, eqs->started, eqs->finished, eqs->dropped, eqs->killed,
+		       eqs->started ? (double)eqs->wait_sum / eqs->started / NSEC_PER_SEC : 0.0, (double)eqs->wait_max / NSEC_PER_SEC,
+		       eqs->finished ? (double)eqs->run_sum / eqs->finished / NSEC_PER_SEC : 0.0, (double)eqs->run_max / NSEC_PER_SEC);
 	}
 }
 
-void exec_queue_delete(pid_t pid)
+/* SIGTERM a script past its deadline and SIGKILL it once the grace time is over too */
+static void exec_queue_deadline(EXEC_QUEUES *eqs, EXEC_QUEUE *eq, int64_t now)
+{
+	int64_t ran = now - eq->started_at;
+
+	if(!eqs->deadline || ran <= eqs->deadline) return;
+
+	if(!eq->signalled) {
+		syslog(LOG_WARNING, "queue %s: %s has run for %.1f s, past its deadline, terminating it", eqs->name, eq->argv[0], (double)ran / NSEC_PER_SEC);
+		if(spawn_kill(eq->job, SIGTERM) == 0) {
+			eq->signalled = SIGTERM;
+			eqs->killed++;
+		}
+	} else if(eq->signalled == SIGTERM && ran > eqs->deadline + eqs->kill_grace) {
+		syslog(LOG_WARNING, "queue %s: %s did not exit on SIGTERM, killing it", eqs->name, eq->argv[0]);
+		if(spawn_kill(eq->job, SIGKILL) == 0) eq->signalled = SIGKILL;
+	}
+}
+
+/*
+  Start waiting scripts of every queue up to its max_running, index
+  them by job, and enforce the deadline of the running ones.
+*/
+void exec_queue_process(int64_t now)
 {
 	EXEC_QUEUES *eqs;
 	EXEC_QUEUE *eq;
 
 	for(eqs = exec_queues_first; eqs; eqs = eqs->next) {
-		EXEC_QUEUE *prev = NULL;
+		for(eq = eqs->running; eq; eq = eq->next) exec_queue_deadline(eqs, eq, now);
 
-		for(eq = eqs->first; eq; eq = eq->next) {
-			if(eq->pid == pid) {
-				if(!prev) { /* this is first */
-					if(!eq->next) { /* last */
-						eqs->first = NULL;
-						eqs->last = NULL;
-					} else { /* not last */
-						eqs->first = eq->next;
-					}
-				} else { /* not first */
-					prev->next = eq->next;
-				}
-				exec_queue_argv_free(eq->argv);
-				exec_queue_envp_free(eq->envp);
-				free(eq);
-				return;
-			}
+		while((eq = eqs->first) != NULL && eqs->nrunning < eqs->max_running) {
+			EXEC_QUEUE **slot;
+
+			if((eq->job = forkexec(eq->argv, eq->envp)) == 0) break;
 
-			prev = eq;
+			eqs->first = eq->next;
+			if(!eqs->first) eqs->last = NULL;
+			eqs->depth--;
+
+			eq->next = eqs->running;
+			eq->prev = NULL;
+			if(eqs->running) eqs->running->prev = eq;
+			eqs->running = eq;
+			eqs->nrunning++;
+
+			slot = &exec_queue_jobs[eq->job & (EXEC_HASH_SIZE - 1)];
+			eq->jnext = *slot;
+			*slot = eq;
+
+			eq->started_at = now;
+			eqs->started++;
+			eqs->wait_sum += now - eq->queued_at;
+			if(now - eq->queued_at > eqs->wait_max) eqs->wait_max = now - eq->queued_at;
 		}
 	}
-	if(cfg.debug >= 9) syslog(LOG_ERR, "%s: %s: %d: child pid %d not found", __FILE__, __FUNCTION__, __LINE__, pid);
+}
+
+void exec_queue_delete(int job)
+{
+	EXEC_QUEUE **pp, *eq;
+	EXEC_QUEUES *eqs;
+	int64_t ran;
+
+	for(pp = &exec_queue_jobs[job & (EXEC_HASH_SIZE - 1)]; (eq = *pp) != NULL; pp = &eq->jnext) {
+		if(eq->job != job) continue;
+
+		*pp = eq->jnext;
+
+		eqs = eq->owner;
+		if(eq->prev) eq->prev->next = eq->next;
+		else eqs->running = eq->next;
+		if(eq->next) eq->next->prev = eq->prev;
+		eqs->nrunning--;
+
+		ran = nstime_now() - eq->started_at;
+		eqs->finished++;
+		eqs->run_sum += ran;
+		if(ran > eqs->run_max) eqs->run_max = ran;
+
+		exec_queue_argv_free(eq->argv);
+		free(eq);
+		return;
+	}
+
+	/* scripts run outside of a queue end up here too */
+	if(cfg.debug >= 9) syslog(LOG_ERR, "%s: %s: %d: child job %d not found", __FILE__, __FUNCTION__, __LINE__, job);
+}
+
+/* the spawn helper went away, drop the scripts it was running so the queues move on */
+void exec_queue_lost(void)
+{
+	EXEC_QUEUES *eqs;
+
+	for(eqs = exec_queues_first; eqs; eqs = eqs->next) {
+		while(eqs->running) exec_queue_delete(eqs->running->job);
+	}
+}
+
+static void exec_queue_list_free(EXEC_QUEUE *eq)
+{
+	while(eq) {
+		EXEC_QUEUE *prev_eq = eq;
+
+		eq = eq->next;
+		exec_queue_argv_free(prev_eq->argv);
+		free(prev_eq);
+	}
 }
 
 void exec_queue_free(void)
 {
 	EXEC_QUEUES *eqs;
-	EXEC_QUEUE *eq;
+	int i;
 
 	eqs = exec_queues_first;
 	while(eqs) {
 		EXEC_QUEUES *prev_eqs = eqs;
 
-		eq = eqs->first;
-		while(eq) {
-			EXEC_QUEUE *prev_eq = eq;
-
-			eq = eq->next;
-			free(prev_eq);
-		}
+		exec_queue_list_free(eqs->first);
+		exec_queue_list_free(eqs->running);
 
 		eqs = eqs->next;
+		free(prev_eqs->name);
 		free(prev_eqs);
 	}
 
 	exec_queues_first = NULL;
 	exec_queues_last = NULL;
+	memset(exec_queue_names, 0, sizeof(exec_queue_names));
+	memset(exec_queue_jobs, 0, sizeof(exec_queue_jobs));
+
+	free(exec_envp);
+	exec_envp = NULL;
+
+	for(i = 0; i < exec_maxbatches; i++) {
+		int j;
+
+		for(j = 0; j < exec_batches[i].n; j++) exec_queue_argv_free(exec_batches[i].argvs[j]);
+		free(exec_batches[i].argvs);
+	}
+	free(exec_batches);
+	exec_batches = NULL;
+	exec_nbatches = 0;
+	exec_maxbatches = 0;
+}
+
+/*
+  Batched events. With batch_events the eventscript runs of one
+  decision pass are collected per script and run as one call:
+
+    script batch <count> <fields of the first event> <fields of the next> ...
+
+  where the fields of an event are the arguments the script gets for
+  it alone, all but the script path.
+*/
+void exec_batch_add(char *queue, char **argv)
+{
+	EXEC_BATCH *b;
+	int i;
+
+	for(i = 0; i < exec_nbatches; i++) {
+		if(!strcmp(exec_batches[i].argvs[0][0], argv[0])) break;
+	}
+
+	if(i == exec_nbatches) {
+		if(exec_nbatches >= exec_maxbatches) {
+			int n = exec_maxbatches ? exec_maxbatches * 2 : 4;
+
+			if((b = realloc(exec_batches, n * sizeof(EXEC_BATCH))) == NULL) {
+				syslog(LOG_ERR, "%s: %s: %d: realloc failed %s", __FILE__, __FUNCTION__, __LINE__, strerror(errno));
+				exec_queue_argv_free(argv);
+				return;
+			}
+			memset(b + exec_maxbatches, 0, (n - exec_maxbatches) * sizeof(EXEC_BATCH));
+			exec_batches = b;
+			exec_maxbatches = n;
+		}
+	}
+
+	b = &exec_batches[i];
+
+	if(b->n >= b->max) {
+		char ***a;
+		int n = b->max ? b->max * 2 : 8;
+
+		if((a = realloc(b->argvs, n * sizeof(char **))) == NULL) {
+			syslog(LOG_ERR, "%s: %s: %d: realloc failed %s", __FILE__, __FUNCTION__, __LINE__, strerror(errno));
+			exec_queue_argv_free(argv);
+			return;
+		}
+		b->argvs = a;
+		b->max = n;
+	}
+
+	/* the first event with a queue decides where the batch goes */
+	if(b->n == 0) b->queue = NULL;
+	if(!b->queue && queue && *queue) b->queue = queue;
+
+	b->argvs[b->n++] = argv;
+
+	/* counted only now, the lookup above reads the first argv of every batch */
+	if(i == exec_nbatches) exec_nbatches++;
+}
+
+/* run what the last decision pass collected, one call per script */
+void exec_batch_flush(void)
+{
+	EXEC_BATCH *b;
+	char **argv, *p;
+	char cnt[16];
+	size_t len;
+	int i, j, k, nargs;
+
+	for(b = exec_batches; b < exec_batches + exec_nbatches; b++) {
+		if(b->n == 0) continue;
+
+		snprintf(cnt, sizeof(cnt), "%d", b->n);
+
+		nargs = 3;
+		len = strlen(b->argvs[0][0]) + 1 + strlen("batch") + 1 + strlen(cnt) + 1;
+		for(j = 0; j < b->n; j++) {
+			for(k = 1; b->argvs[j][k]; k++, nargs++) len += strlen(b->argvs[j][k]) + 1;
+		}
+
+		if((argv = malloc((nargs + 1) * sizeof(char *) + len)) == NULL) {
+			syslog(LOG_ERR, "%s: %s: %d: malloc failed %s", __FILE__, __FUNCTION__, __LINE__, strerror(errno));
+		} else {
+			p = (char *)(argv + nargs + 1);
+			argv[0] = p; p = stpcpy(p, b->argvs[0][0]) + 1;
+			argv[1] = p; p = stpcpy(p, "batch") + 1;
+			argv[2] = p; p = stpcpy(p, cnt) + 1;
+
+			for(i = 3, j = 0; j < b->n; j++) {
+				for(k = 1; b->argvs[j][k]; k++) {
+					argv[i++] = p;
+					p = stpcpy(p, b->argvs[j][k]) + 1;
+				}
+			}
+			argv[i] = NULL;
+
+			if(cfg.debug >= 8) syslog(LOG_INFO, "%s: %s: %d: %d events to %s in one call", __FILE__, __FUNCTION__, __LINE__, b->n, argv[0]);
+
+			if(b->queue) {
+				exec_queue_add(b->queue, argv, exec_queue_envp());
+			} else {
+				forkexec(argv, exec_queue_envp());
+				exec_queue_argv_free(argv);
+			}
+		}
+
+		for(j = 0; j < b->n; j++) exec_queue_argv_free(b->argvs[j]);
+		b->n = 0;
+	}
+
+	exec_nbatches = 0;
 }
 
+/*
+  Build an argv in a single allocation, the pointer array first and
+  the strings packed after it, so that one free() releases it all.
+*/
 char **exec_queue_argv(char *fmt, ...)
 {
-	va_list vl;
+	va_list vl, vl2;
 	char **argv;
-	char *s;
+	char *s, *p;
 	int fmt_cnt;
-	char buf[BUFSIZ];
-	int i;
+	size_t len;
+	int i, n;
 
 	s = fmt;
 	fmt_cnt = 0;
@@ -314,37 +584,73 @@ char **exec_queue_argv(char *fmt, ...)
 		if(*s++ == '%') fmt_cnt++;
 	}
 
-	if((argv = malloc((fmt_cnt + 1) * sizeof(char *))) == NULL) {
+	/* first pass for the size of the strings */
+	len = 0;
+	va_start(vl, fmt);
+	va_copy(vl2, vl);
+	for(s = fmt; *s; s++) {
+		if(*s != '%') continue;
+
+		switch(*++s) {
+		case 's': /* string */
+			len += strlen(va_arg(vl, char *)) + 1;
+			break;
+
+		case 'd': /* int */
+			len += snprintf(NULL, 0, "%d", va_arg(vl, int)) + 1;
+			break;
+
+		case 'u': /* unsigned int */
+			len += snprintf(NULL, 0, "%u", va_arg(vl, unsigned int)) + 1;
+			break;
+
+		case '\0':
+			s--;
+			break;
+
+		default: /* skip unknown directives */
+			break;
+		}
+	}
+	va_end(vl);
+
+	if((argv = malloc((fmt_cnt + 1) * sizeof(char *) + len)) == NULL) {
 		syslog(LOG_ERR, "%s: %s: failed to malloc %s", __FILE__, __FUNCTION__, strerror(errno));
+		va_end(vl2);
 		return(NULL);
 	}
 
-	s = fmt;
+	/* second pass to fill it in */
+	p = (char *)(argv + fmt_cnt + 1);
 	i = 0;
-	va_start(vl, fmt);
-	while(*s) {
-		if(*s == '%') {
-			s++;
-			switch(*s++) {
-			case 's': /* string */
-				argv[i] = strdup(va_arg(vl, char *));
-				i++;
-				break;
-
-			case 'd': /* int */
-				snprintf(buf, BUFSIZ - 1, "%d", va_arg(vl, int));
-				argv[i] = strdup(buf);
-				i++;
-				break;
-
-			default: /* skip unknown directives */
-				break;
-			}
-		} else {
-			s++;
+	for(s = fmt; *s; s++) {
+		if(*s != '%') continue;
+
+		switch(*++s) {
+		case 's': /* string */
+			n = stpcpy(p, va_arg(vl2, char *)) - p;
+			break;
+
+		case 'd': /* int */
+			n = sprintf(p, "%d", va_arg(vl2, int));
+			break;
+
+		case 'u': /* unsigned int */
+			n = sprintf(p, "%u", va_arg(vl2, unsigned int));
+			break;
+
+		case '\0':
+			s--;
+			continue;
+
+		default: /* skip unknown directives */
+			continue;
 		}
+
+		argv[i++] = p;
+		p += n + 1;
 	}
-	va_end(vl);
+	va_end(vl2);
 
 	argv[i] = NULL;
 
@@ -353,48 +659,42 @@ char **exec_queue_argv(char *fmt, ...)
 
 void exec_queue_argv_free(char **argv)
 {
-	int i;
-
-	for(i = 0; argv[i]; i++) {
-		free(argv[i]);
-	}
-
 	free(argv);
 }
 
+/*
+  The environment handed to scripts does not change while we run, so
+  it is built once, in a single allocation, and shared by every event.
+*/
 char **exec_queue_envp(void)
 {
-	char **envp;
-	char buf[BUFSIZ];
+	static const char *names[] = { "LANG", "PATH", "TERM", NULL };
+	const char *val[3];
+	size_t len;
+	char *p;
+	int i;
+
+	if(exec_envp) return(exec_envp);
+
+	len = 0;
+	for(i = 0; names[i]; i++) {
+		if((val[i] = getenv(names[i])) == NULL) val[i] = "(null)";
+		len += strlen(names[i]) + strlen(val[i]) + 2;
+	}
 
-	if((envp = malloc(4 * sizeof(char *))) == NULL) {
+	if((exec_envp = malloc((i + 1) * sizeof(char *) + len)) == NULL) {
 		syslog(LOG_ERR, "%s: %s: malloc failed %s", __FILE__, __FUNCTION__, strerror(errno));
 		return(NULL);
 	}
 
-	snprintf(buf, BUFSIZ - 1, "LANG=%s", getenv("LANG"));
-	envp[0] = strdup(buf);
-
-	snprintf(buf, BUFSIZ - 1, "PATH=%s", getenv("PATH"));
-	envp[1] = strdup(buf);
-
-	snprintf(buf, BUFSIZ - 1, "TERM=%s", getenv("TERM"));
-	envp[2] = strdup(buf);
-
-	envp[3] = NULL;
-
-	return(envp);
-}
-
-void exec_queue_envp_free(char **envp)
-{
-	int i;
-
-	for(i = 0; envp[i]; i++) {
-		free(envp[i]);
+	p = (char *)(exec_envp + i + 1);
+	for(i = 0; names[i]; i++) {
+		exec_envp[i] = p;
+		p += sprintf(p, "%s=%s", names[i], val[i]) + 1;
 	}
+	exec_envp[i] = NULL;
 
-	free(envp);
+	return(exec_envp);
 }
 
 /* EOF */
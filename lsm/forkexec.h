@@ -9,16 +9,24 @@ License: GPLv2
 #ifndef __FORKEXEC_H__
 #define __FORKEXEC_H__
 
-pid_t forkexec(char **argv, char **envp);
-void create_sigchld_hdl(void);
+#include <stdint.h>
+
+int forkexec(char **argv, char **envp);
+void create_sigchld_fd(void);
+void reap_children(void);
+void close_sigchld_fd(void);
 void exec_queue_add(char *queue, char **argv, char **envp);
-void exec_queue_process(void);
+void exec_queue_process(int64_t now);
+void exec_queue_configure(void);
+void exec_queue_stats(void);
 char **exec_queue_argv(char *fmt, ...);
 void exec_queue_argv_free(char **argv);
 char **exec_queue_envp(void);
-void exec_queue_envp_free(char **envp);
-void exec_queue_delete(pid_t pid);
+void exec_queue_delete(int job);
+void exec_queue_lost(void);
 void exec_queue_free(void);
+void exec_batch_add(char *queue, char **argv);
+void exec_batch_flush(void);
 
 #if defined(DEBUG)
 void exec_queue_dump(void);
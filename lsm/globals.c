@@ -23,7 +23,7 @@ static int dump_if_list = FALSE;
 static char *configfile = FOOLSM_CONFIG_FILE;
 static char *pidfile = "/var/run/foolsm.pid";
 static int nodaemon = 0;
-static char *status_str[] = { "down", "up", "unknown", "long_down" };
+static char *status_str[] = { "down", "up", "unknown", "long_down", "degraded" };
 
 void set_prog(char *val)
 {
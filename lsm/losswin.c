@@ -0,0 +1,98 @@
+/*
+
+  (C) 2026 Mika Ilmaranta <ilmis@nullnet.fi>
+
+  License: GPLv2
+
+*/
+
+/*
+  Time bucketed probe loss. Every probe counts once, in the bucket of
+  the time it was sent, when it is either answered in time or found to
+  have timed out. Probes still on their way are left out, so a burst of
+  probes does not water the loss down before their fate is known.
+*/
+
+#include <string.h>
+
+#include "timecalc.h"
+#include "losswin.h"
+
+void loss_win_init(LOSS_WIN *lw, int window_s)
+{
+	memset(lw, 0, sizeof(LOSS_WIN));
+
+	if(window_s <= 0) return;
+
+	lw->bucket_ns = (int64_t)window_s * NSEC_PER_SEC / LOSS_BUCKETS;
+}
+
+/* drop the buckets that have slid out of the window by now */
+void loss_win_advance(LOSS_WIN *lw, int64_t now)
+{
+	int64_t n, k;
+
+	if(!lw->bucket_ns) return;
+
+	n = now / lw->bucket_ns;
+	if(n <= lw->head) return;
+
+	if(n - lw->head >= LOSS_BUCKETS) {
+		memset(lw->done, 0, sizeof(lw->done));
+		memset(lw->lost, 0, sizeof(lw->lost));
+		lw->done_sum = 0;
+		lw->lost_sum = 0;
+	} else {
+		for(k = lw->head + 1; k <= n; k++) {
+			int i = k % LOSS_BUCKETS;
+
+			lw->done_sum -= lw->done[i];
+			lw->lost_sum -= lw->lost[i];
+			lw->done[i] = 0;
+			lw->lost[i] = 0;
+		}
+	}
+
+	lw->head = n;
+}
+
+void loss_win_add(LOSS_WIN *lw, int64_t sent, int lost, int64_t now)
+{
+	int64_t k;
+	int i;
+
+	if(!lw->bucket_ns) return;
+
+	loss_win_advance(lw, now);
+
+	k = sent / lw->bucket_ns;
+
+	/* sent before the window, or clocks disagree */
+	if(k <= lw->head - LOSS_BUCKETS || k > lw->head) return;
+
+	i = k % LOSS_BUCKETS;
+
+	lw->done[i]++;
+	lw->done_sum++;
+
+	if(lost) {
+		lw->lost[i]++;
+		lw->lost_sum++;
+	}
+}
+
+/* is more than pct percent of the probes in the window lost */
+int loss_win_above(const LOSS_WIN *lw, int pct)
+{
+	return((uint64_t)lw->lost_sum * 100 > (uint64_t)pct * lw->done_sum);
+}
+
+/* loss percentage of the probes in the window, 0 when there are none */
+int loss_win_pct(const LOSS_WIN *lw)
+{
+	if(!lw->done_sum) return(0);
+
+	return((int)((uint64_t)lw->lost_sum * 100 / lw->done_sum));
+}
+
+/* EOF */
@@ -0,0 +1,38 @@
+/*
+
+  (C) 2026 Mika Ilmaranta <ilmis@nullnet.fi>
+
+  License: GPLv2
+
+*/
+
+#ifndef __LOSSWIN_H__
+#define __LOSSWIN_H__
+
+#include <stdint.h>
+
+/*
+  Sliding window of probe outcomes over a span of time rather than a
+  number of probes. The span is cut in LOSS_BUCKETS buckets, so the
+  window slides in steps of 1/LOSS_BUCKETS of its length.
+*/
+#define LOSS_BUCKETS (32)
+
+typedef struct loss_win {
+	uint32_t done[LOSS_BUCKETS]; /* probes replied in time or timed out, by send time */
+	uint32_t lost[LOSS_BUCKETS]; /* of those the ones that timed out */
+	uint32_t done_sum;
+	uint32_t lost_sum;
+	int64_t bucket_ns;           /* 0 when not in use */
+	int64_t head;                /* number of the newest bucket, time / bucket_ns */
+} LOSS_WIN;
+
+void loss_win_init(LOSS_WIN *lw, int window_s);
+void loss_win_add(LOSS_WIN *lw, int64_t sent, int lost, int64_t now);
+void loss_win_advance(LOSS_WIN *lw, int64_t now);
+int loss_win_above(const LOSS_WIN *lw, int pct);
+int loss_win_pct(const LOSS_WIN *lw);
+
+#endif
+
+/* EOF */
@@ -27,24 +27,20 @@ static char *munin_data_src_name(const char *src);
 static void plugin_export_munin(CONFIG *first);
 #endif
 
-static struct timeval export_time = {0, 0};
+static int64_t export_time = 0;
 
 void plugin_export_init(void)
 {
-	gettimeofday(&export_time, NULL);
+	export_time = nstime_now();
 }
 
-void plugin_export(CONFIG *first)
+void plugin_export(CONFIG *first, int64_t now)
 {
-	struct timeval current_time = {0, 0};
-
-	gettimeofday(&current_time, NULL);
-
 	/* export every 300s */
-	if(timeval_diff_cmp(&current_time, &export_time, TIMEVAL_DIFF_CMP_GT, 300, 0) == FALSE) return;
+	if(now - export_time <= 300 * NSEC_PER_SEC) return;
 
 	/* next export after 300 sec */
-	timeval_add(&export_time, 300, 0);
+	export_time += 300 * NSEC_PER_SEC;
 
 #ifndef NO_PLUGIN_EXPORT_MUNIN
 	plugin_export_munin(first);
@@ -67,7 +63,7 @@ static void plugin_export_munin(CONFIG *first)
 		return;
 	}
 
-	fprintf(fp, "graph_title Foolsm Average Ping Latency\n");
+	fprintf(fp, "graph_title Foolsm Ping Latency\n");
 	fprintf(fp, "graph_vlabel ms\n");
 	fprintf(fp, "graph_info This graph shows Foolsm status\n");
 	fprintf(fp, "graph_category network\n");
@@ -78,6 +74,24 @@ static void plugin_export_munin(CONFIG *first)
 
 		fprintf(fp, "%s_rtt.label %s rtt\n", name, cur->name);
 		fprintf(fp, "%s_rtt.type GAUGE\n", name);
+
+		fprintf(fp, "%s_p50.label %s rtt 50th percentile\n", name, cur->name);
+		fprintf(fp, "%s_p50.type GAUGE\n", name);
+
+		fprintf(fp, "%s_p95.label %s rtt 95th percentile\n", name, cur->name);
+		fprintf(fp, "%s_p95.type GAUGE\n", name);
+
+		fprintf(fp, "%s_p99.label %s rtt 99th percentile\n", name, cur->name);
+		fprintf(fp, "%s_p99.type GAUGE\n", name);
+
+		fprintf(fp, "%s_min.label %s rtt min\n", name, cur->name);
+		fprintf(fp, "%s_min.type GAUGE\n", name);
+
+		fprintf(fp, "%s_max.label %s rtt max\n", name, cur->name);
+		fprintf(fp, "%s_max.type GAUGE\n", name);
+
+		fprintf(fp, "%s_jitter.label %s jitter\n", name, cur->name);
+		fprintf(fp, "%s_jitter.type GAUGE\n", name);
 	}
 
 	fclose(fp);
@@ -92,9 +106,24 @@ static void plugin_export_munin(CONFIG *first)
 
 	for(cur = first; cur; cur = cur->next) {
 		char *name = munin_data_src_name(cur->name);
+		int down;
+
 		t = cur->data;
+		down = (t->status == DOWN || t->status == LONG_DOWN);
+
+		fprintf(fp, "%s_rtt.value %.2f\n", name, down ? 0.0 : t->avg_rtt / 1000.0);
+
+		fprintf(fp, "%s_p50.value %.2f\n", name, down ? 0.0 : t->cold->rtt.p50 / 1000.0);
+
+		fprintf(fp, "%s_p95.value %.2f\n", name, down ? 0.0 : t->cold->rtt.p95 / 1000.0);
+
+		fprintf(fp, "%s_p99.value %.2f\n", name, down ? 0.0 : t->cold->rtt.p99 / 1000.0);
+
+		fprintf(fp, "%s_min.value %.2f\n", name, down ? 0.0 : t->cold->rtt.min / 1000.0);
+
+		fprintf(fp, "%s_max.value %.2f\n", name, down ? 0.0 : t->cold->rtt.max / 1000.0);
 
-		fprintf(fp, "%s_rtt.value %.2f\n", name, (t->status == DOWN || t->status == LONG_DOWN) ? 0.0 : t->avg_rtt / 1000.0);
+		fprintf(fp, "%s_jitter.value %.2f\n", name, down ? 0.0 : t->cold->rtt.jitter / 1000.0);
 	}
 
 	fclose(fp);
@@ -181,8 +210,8 @@ static void plugin_export_munin(CONFIG *first)
 	fprintf(fp, "graph_vlabel Status\n");
 	fprintf(fp, "graph_info This graph shows Foolsm connection statuses\n");
 	fprintf(fp, "graph_category network\n");
-	fprintf(fp, "graph_info Status: 0 = DOWN, 1 = UP, 2 = UNKNOWN, 3 = LONG_DOWN\n");
-	fprintf(fp, "graph_args --base 1000 --lower-limit 0 --upper-limit 3\n");
+	fprintf(fp, "graph_info Status: 0 = DOWN, 1 = UP, 2 = UNKNOWN, 3 = LONG_DOWN, 4 = DEGRADED\n");
+	fprintf(fp, "graph_args --base 1000 --lower-limit 0 --upper-limit 4\n");
 
 	for(cur = first; cur; cur = cur->next) {
 		char *name = munin_data_src_name(cur->name);
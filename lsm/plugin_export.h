@@ -15,7 +15,7 @@ License: GPLv2
 #include "foolsm.h"
 
 void plugin_export_init(void);
-void plugin_export(CONFIG *first);
+void plugin_export(CONFIG *first, int64_t now);
 
 #ifndef NO_PLUGIN_EXPORT_STATUS
 void plugin_export_status(CONFIG *first);
@@ -0,0 +1,116 @@
+/*
+
+  (C) 2026 Mika Ilmaranta <ilmis@nullnet.fi>
+
+  License: GPLv2
+
+*/
+
+/*
+  Streaming round trip time statistics. The histogram is kept in step
+  with the replied pkts of a connection's window, so adding and removing
+  a value are O(1) and a percentile costs one walk over RTT_BUCKETS
+  counters, however long the window is.
+*/
+
+#include "rttstat.h"
+
+static int rtt_bucket(uint32_t v)
+{
+	int e;
+
+	if(v < 2 * RTT_SUBS) return(v);
+
+	e = 31 - __builtin_clz(v);
+
+	return((e - RTT_SUB_BITS + 1) * RTT_SUBS + ((v >> (e - RTT_SUB_BITS)) & (RTT_SUBS - 1)));
+}
+
+/* middle of the range of values counted in bucket b */
+static uint32_t rtt_bucket_value(int b)
+{
+	int e;
+	uint32_t lo, width;
+
+	if(b < 2 * RTT_SUBS) return(b);
+
+	e = b / RTT_SUBS + RTT_SUB_BITS - 1;
+	width = 1U << (e - RTT_SUB_BITS);
+	lo = (uint32_t)(RTT_SUBS + b % RTT_SUBS) << (e - RTT_SUB_BITS);
+
+	return(lo + (width - 1) / 2);
+}
+
+void rtt_hist_add(RTT_HIST *rh, uint32_t v)
+{
+	if(rh->n == 0) {
+		rh->min = v;
+		rh->max = v;
+	} else if(!rh->rescan) {
+		if(v < rh->min) rh->min = v;
+		if(v > rh->max) rh->max = v;
+	}
+
+	rh->count[rtt_bucket(v)]++;
+	rh->n++;
+}
+
+void rtt_hist_del(RTT_HIST *rh, uint32_t v)
+{
+	int b = rtt_bucket(v);
+
+	if(rh->count[b] == 0) return;
+
+	rh->count[b]--;
+	rh->n--;
+
+	/* the owner of the values has to find the new ends */
+	if(rh->n == 0) rh->rescan = 0;
+	else if(v == rh->min || v == rh->max) rh->rescan = 1;
+}
+
+/* RFC 3550 section 6.4.1, with the rtt standing in for the transit time */
+void rtt_hist_jitter(RTT_HIST *rh, uint32_t v)
+{
+	if(rh->primed) {
+		uint32_t d = v > rh->prev ? v - rh->prev : rh->prev - v;
+
+		rh->jitter += d - ((rh->jitter + 8) >> 4);
+	}
+
+	rh->prev = v;
+	rh->primed = 1;
+}
+
+/*
+  The pct percentile of the values in the histogram, reported as the
+  middle of its bucket and kept within min and max when they are known.
+*/
+uint32_t rtt_hist_percentile(const RTT_HIST *rh, int pct)
+{
+	long rank, seen = 0;
+	uint32_t v = 0;
+	int b;
+
+	if(rh->n <= 0) return(0);
+
+	rank = ((long)rh->n * pct + 99) / 100;
+	if(rank < 1) rank = 1;
+
+	for(b = 0; b < RTT_BUCKETS; b++) {
+		seen += rh->count[b];
+		if(seen >= rank) {
+			v = rtt_bucket_value(b);
+			break;
+		}
+	}
+
+	if(!rh->rescan) {
+		if(v < rh->min) v = rh->min;
+		if(v > rh->max) v = rh->max;
+	}
+
+	return(v);
+}
+
+/* EOF */
@@ -0,0 +1,51 @@
+/*
+
+  (C) 2026 Mika Ilmaranta <ilmis@nullnet.fi>
+
+  License: GPLv2
+
+*/
+
+#ifndef __RTTSTAT_H__
+#define __RTTSTAT_H__
+
+#include <stdint.h>
+
+/*
+  Log bucketed round trip time histogram. Every power of two is split
+  into RTT_SUBS buckets, so a value is known to within 1/RTT_SUBS of
+  itself, and values below 2 * RTT_SUBS usec are kept exactly.
+*/
+#define RTT_SUB_BITS (4)
+#define RTT_SUBS     (1 << RTT_SUB_BITS)
+#define RTT_BUCKETS  (RTT_SUBS * (32 - RTT_SUB_BITS + 1)) /* covers all of uint32_t */
+
+typedef struct rtt_hist {
+	uint16_t count[RTT_BUCKETS]; /* a window never holds more than 0xffff pkts */
+	int n;           /* values in the histogram */
+	uint32_t min;    /* usec, exact unless rescan is set */
+	uint32_t max;
+	int rescan;      /* min or max has left the histogram */
+	uint32_t prev;   /* usec, rtt of the previous reply */
+	uint32_t jitter; /* RFC 3550 interarrival jitter, usec scaled by 16 */
+	int primed;      /* prev is valid */
+} RTT_HIST;
+
+/* figures derived from a RTT_HIST, all in usec */
+typedef struct rtt_stats {
+	uint32_t min;
+	uint32_t max;
+	uint32_t p50;
+	uint32_t p95;
+	uint32_t p99;
+	uint32_t jitter;
+} RTT_STATS;
+
+void rtt_hist_add(RTT_HIST *rh, uint32_t v);
+void rtt_hist_del(RTT_HIST *rh, uint32_t v);
+void rtt_hist_jitter(RTT_HIST *rh, uint32_t v);
+uint32_t rtt_hist_percentile(const RTT_HIST *rh, int pct);
+
+#endif
+
+/* EOF */
@@ -0,0 +1,183 @@
+/*
+
+  (C) 2026 Mika Ilmaranta <ilmis@nullnet.fi>
+
+  License: GPLv2
+
+*/
+
+/*
+  Deadline ordered probe scheduler. Connections are kept in a binary
+  min-heap keyed by the time their next probe is due, so the main loop
+  only looks at the connection at the top and can sleep until exactly
+  that moment. The heap holds the targets themselves so sifting does not
+  touch the config entries.
+
+  A second heap keyed by tmo_at, the moment the oldest unanswered probe
+  of a connection times out, lets that probe be marked at its deadline
+  rather than on the next pass over all connections.
+*/
+
+#include <stdlib.h>
+#include <syslog.h>
+
+#include "config.h"
+#include "foolsm.h"
+#include "sched.h"
+
+typedef struct sched_heap {
+	TARGET **t;
+	int len;
+	int size;
+	int tmo; /* keyed by tmo_at rather than next_send */
+} SCHED_HEAP;
+
+static SCHED_HEAP send_heap = { NULL, 0, 0, 0 };
+static SCHED_HEAP tmo_heap = { NULL, 0, 0, 1 };
+
+static int heap_init(SCHED_HEAP *h, int size);
+static void heap_free(SCHED_HEAP *h);
+static void heap_add(SCHED_HEAP *h, TARGET *t);
+static int *heap_idx(SCHED_HEAP *h, TARGET *t);
+static int heap_before(SCHED_HEAP *h, int a, int b);
+static void heap_swap(SCHED_HEAP *h, int a, int b);
+static void heap_sift_up(SCHED_HEAP *h, int i);
+static void heap_sift_down(SCHED_HEAP *h, int i);
+
+int sched_init(int size)
+{
+	sched_free();
+
+	if(heap_init(&send_heap, size) || heap_init(&tmo_heap, size)) return(1);
+
+	return(0);
+}
+
+void sched_free(void)
+{
+	heap_free(&send_heap);
+	heap_free(&tmo_heap);
+}
+
+void sched_add(CONFIG *cur)
+{
+	TARGET *t = cur->data;
+
+	if(send_heap.len >= send_heap.size || tmo_heap.len >= tmo_heap.size) {
+		syslog(LOG_ERR, "%s: %s: scheduler heap full, %s not scheduled", __FILE__, __FUNCTION__, cur->name);
+		return;
+	}
+
+	heap_add(&send_heap, t);
+	heap_add(&tmo_heap, t);
+}
+
+/* restore heap order after the deadline of cur has been changed */
+void sched_update(CONFIG *cur)
+{
+	TARGET *t = cur->data;
+
+	heap_sift_up(&send_heap, t->sched_idx);
+	heap_sift_down(&send_heap, t->sched_idx);
+}
+
+TARGET *sched_first(void)
+{
+	if(send_heap.len == 0) return(NULL);
+
+	return(send_heap.t[0]);
+}
+
+/* restore heap order after tmo_at of t has been changed */
+void sched_tmo_update(TARGET *t)
+{
+	heap_sift_up(&tmo_heap, t->tmo_idx);
+	heap_sift_down(&tmo_heap, t->tmo_idx);
+}
+
+TARGET *sched_tmo_first(void)
+{
+	if(tmo_heap.len == 0) return(NULL);
+
+	return(tmo_heap.t[0]);
+}
+
+static int heap_init(SCHED_HEAP *h, int size)
+{
+	if((h->t = malloc(sizeof(TARGET *) * (size ? size : 1))) == NULL) {
+		syslog(LOG_ERR, "%s: %s: failed to malloc scheduler heap", __FILE__, __FUNCTION__);
+		return(1);
+	}
+	h->size = size;
+	h->len = 0;
+
+	return(0);
+}
+
+static void heap_free(SCHED_HEAP *h)
+{
+	if(h->t) free(h->t);
+
+	h->t = NULL;
+	h->len = 0;
+	h->size = 0;
+}
+
+static void heap_add(SCHED_HEAP *h, TARGET *t)
+{
+	h->t[h->len] = t;
+	*heap_idx(h, t) = h->len;
+	h->len++;
+
+	heap_sift_up(h, h->len - 1);
+}
+
+static int *heap_idx(SCHED_HEAP *h, TARGET *t)
+{
+	return(h->tmo ? &t->tmo_idx : &t->sched_idx);
+}
+
+static int heap_before(SCHED_HEAP *h, int a, int b)
+{
+	if(h->tmo) return(h->t[a]->tmo_at < h->t[b]->tmo_at);
+
+	return(h->t[a]->next_send < h->t[b]->next_send);
+}
+
+static void heap_swap(SCHED_HEAP *h, int a, int b)
+{
+	TARGET *tmp;
+
+	tmp = h->t[a];
+	h->t[a] = h->t[b];
+	h->t[b] = tmp;
+
+	*heap_idx(h, h->t[a]) = a;
+	*heap_idx(h, h->t[b]) = b;
+}
+
+static void heap_sift_up(SCHED_HEAP *h, int i)
+{
+	while(i > 0 && heap_before(h, i, (i - 1) / 2)) {
+		heap_swap(h, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void heap_sift_down(SCHED_HEAP *h, int i)
+{
+	for(;;) {
+		int l = 2 * i + 1;
+		int r = l + 1;
+		int m = i;
+
+		if(l < h->len && heap_before(h, l, m)) m = l;
+		if(r < h->len && heap_before(h, r, m)) m = r;
+		if(m == i) break;
+
+		heap_swap(h, i, m);
+		i = m;
+	}
+}
+
+/* EOF */
@@ -0,0 +1,25 @@
+/*
+
+  (C) 2026 Mika Ilmaranta <ilmis@nullnet.fi>
+
+  License: GPLv2
+
+*/
+
+#ifndef __SCHED_H__
+#define __SCHED_H__
+
+#include "config.h"
+#include "foolsm.h"
+
+int sched_init(int size);
+void sched_free(void);
+void sched_add(CONFIG *cur);
+void sched_update(CONFIG *cur);
+TARGET *sched_first(void);
+void sched_tmo_update(TARGET *t);
+TARGET *sched_tmo_first(void);
+
+#endif
+
+/* EOF */
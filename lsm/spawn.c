@@ -0,0 +1,526 @@
+/*
+
+  (C) 2026 Mika Ilmaranta <ilmis@nullnet.fi>
+
+  License: GPLv2
+
+*/
+
+/*
+  Event and notify scripts are started by a small helper process that
+  is forked once at startup, while the daemon is still small and holds
+  no sockets or tables. The main loop hands it argv and envp over a
+  unix socketpair, which costs one non-blocking write, and the helper
+  starts the script with posix_spawn, which shares its memory with the
+  child until the exec instead of copying page tables. It reports back
+  over the same channel when a script has exited or could not be
+  started, so named queues still know when to start their next entry.
+
+  Jobs are numbered by the main process. The helper keeps the pid of
+  every job it runs and is the only one to reap them.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <syslog.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <spawn.h>
+
+#include "config.h"
+#include "forkexec.h"
+#include "spawn.h"
+
+/* requests the channel had no room for, sent on from spawn_poll() */
+#define SPAWN_BACKLOG (256)
+
+typedef struct spawn_msg {
+	struct spawn_msg *next;
+	size_t len;
+	char data[];
+} SPAWN_MSG;
+
+typedef struct spawn_kid {
+	pid_t pid;
+	uint32_t job;
+} SPAWN_KID;
+
+static void spawn_server(int fd);
+static int spawn_server_run(int fd, char *buf, int len, SPAWN_KID **kids, int *nkids, int *maxkids);
+static int spawn_server_fail(int fd, uint32_t job, int err);
+static void spawn_server_reap(int fd, SPAWN_KID *kids, int *nkids);
+static void spawn_server_kill(char *buf, int len, SPAWN_KID *kids, int nkids);
+static void spawn_lost(const char *why);
+static int spawn_send(const void *buf, size_t len);
+static int spawn_flush(void);
+static void spawn_backlog_free(void);
+
+/* main process side */
+static int spawn_fd = -1;
+static pid_t spawn_pid = 0;
+static int spawn_dead = 0;
+static int spawn_running = 0; /* jobs handed over and not yet reported back */
+static uint32_t spawn_next = 0;
+static char spawn_buf[SPAWN_MSGSIZE];
+static SPAWN_MSG *backlog_first = NULL;
+static SPAWN_MSG *backlog_last = NULL;
+static int backlog_len = 0;
+
+int spawn_start(void)
+{
+	int sv[2];
+	pid_t pid;
+
+	if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+		syslog(LOG_ERR, "%s: %s: socketpair failed \"%s\"", __FILE__, __FUNCTION__, strerror(errno));
+		return(1);
+	}
+
+	if((pid = fork()) == -1) {
+		syslog(LOG_ERR, "%s: %s: fork failed \"%s\"", __FILE__, __FUNCTION__, strerror(errno));
+		close(sv[0]);
+		close(sv[1]);
+		return(1);
+	}
+
+	if(pid == 0) {
+		close(sv[0]);
+		spawn_server(sv[1]);
+	}
+
+	close(sv[1]);
+	if(fcntl(sv[0], F_SETFL, O_NONBLOCK) == -1) syslog(LOG_ERR, "%s: %s: failed to make channel non-blocking \"%s\"", __FILE__, __FUNCTION__, strerror(errno));
+
+	spawn_fd = sv[0];
+	spawn_pid = pid;
+	spawn_dead = 0;
+	spawn_running = 0;
+
+	if(cfg.debug >= 9) syslog(LOG_INFO, "%s: %s: script spawner started with pid %d", __FILE__, __FUNCTION__, pid);
+
+	return(0);
+}
+
+/* the helper exits when it sees the channel close, scripts still running are left alone */
+void spawn_stop(void)
+{
+	if(backlog_len) syslog(LOG_ERR, "%s: %s: %d scripts not handed over to the script spawner", __FILE__, __FUNCTION__, backlog_len);
+	spawn_backlog_free();
+
+	if(spawn_fd != -1) close(spawn_fd);
+
+	spawn_fd = -1;
+	spawn_pid = 0;
+	spawn_running = 0;
+}
+
+/* hand argv and envp over to the helper, returns the job number or 0 on failure */
+int spawn_job(char **argv, char **envp)
+{
+	SPAWN_REQ *rq = (SPAWN_REQ *)spawn_buf;
+	size_t len = sizeof(SPAWN_REQ);
+	int i;
+
+	if(spawn_dead) spawn_lost("script spawner exited");
+	if(spawn_fd == -1 && spawn_start()) return(0);
+
+	rq->type = SPAWN_RUN;
+	rq->job = spawn_next = spawn_next % 0x7fffffff + 1;
+	rq->argc = 0;
+	rq->envc = 0;
+	rq->sig = 0;
+
+	for(i = 0; argv[i]; i++, rq->argc++) {
+		size_t n = strlen(argv[i]) + 1;
+
+		if(len + n > SPAWN_MSGSIZE) goto toolong;
+		memcpy(spawn_buf + len, argv[i], n);
+		len += n;
+	}
+
+	for(i = 0; envp[i]; i++, rq->envc++) {
+		size_t n = strlen(envp[i]) + 1;
+
+		if(len + n > SPAWN_MSGSIZE) goto toolong;
+		memcpy(spawn_buf + len, envp[i], n);
+		len += n;
+	}
+
+	/* never wait for the helper, what does not fit now waits in the backlog in order */
+	if(!backlog_first) {
+		int r = spawn_send(spawn_buf, len);
+
+		if(r < 0) return(0);
+		if(r == 0) {
+			spawn_running++;
+			return(rq->job);
+		}
+	}
+
+	if(backlog_len >= SPAWN_BACKLOG) {
+		syslog(LOG_ERR, "%s: %s: script spawner does not keep up, %s not run", __FILE__, __FUNCTION__, argv[0]);
+		return(0);
+	} else {
+		SPAWN_MSG *m;
+
+		if((m = malloc(sizeof(SPAWN_MSG) + len)) == NULL) {
+			syslog(LOG_ERR, "%s: %s: malloc failed %s", __FILE__, __FUNCTION__, strerror(errno));
+			return(0);
+		}
+		m->next = NULL;
+		m->len = len;
+		memcpy(m->data, spawn_buf, len);
+
+		if(backlog_last) backlog_last->next = m;
+		else backlog_first = m;
+		backlog_last = m;
+		backlog_len++;
+	}
+
+	spawn_running++;
+
+	return(rq->job);
+
+ toolong:
+	syslog(LOG_ERR, "%s: %s: arguments of %s do not fit in a request", __FILE__, __FUNCTION__, argv[0]);
+	return(0);
+}
+
+/* have the helper signal a running job and whatever it has started */
+int spawn_kill(int job, int sig)
+{
+	SPAWN_REQ rq;
+
+	/* the job may not have reached the helper yet, try again next time */
+	if(spawn_fd == -1 || spawn_dead || backlog_first) return(1);
+
+	memset(&rq, 0, sizeof(rq));
+	rq.type = SPAWN_KILL;
+	rq.job = job;
+	rq.sig = sig;
+
+	while(send(spawn_fd, &rq, sizeof(rq), MSG_NOSIGNAL) == -1) {
+		if(errno == EINTR) continue;
+
+		syslog(LOG_ERR, "%s: %s: failed to send signal %d to job %d \"%s\"", __FILE__, __FUNCTION__, sig, job, strerror(errno));
+		return(1);
+	}
+
+	return(0);
+}
+
+/* collect what the helper has to report, costs nothing while no job is out */
+void spawn_poll(void)
+{
+	SPAWN_REP rep;
+	ssize_t n;
+
+	if(spawn_dead) {
+		spawn_lost("script spawner exited");
+		return;
+	}
+
+	if(spawn_fd == -1) return;
+
+	if(backlog_first && spawn_flush()) return;
+
+	if(spawn_running == 0) return;
+
+	while((n = recv(spawn_fd, &rep, sizeof(rep), MSG_DONTWAIT)) != 0) {
+		if(n == -1) {
+			if(errno == EINTR) continue;
+			if(errno != EAGAIN) spawn_lost(strerror(errno));
+			return;
+		}
+
+		if(n != sizeof(rep)) continue;
+
+		if(rep.type == SPAWN_FAILED) {
+			syslog(LOG_ERR, "%s: %s: failed to start script \"%s\"", __FILE__, __FUNCTION__, strerror(rep.status));
+		} else if(rep.type == SPAWN_EXITED) {
+			if(cfg.debug >= 9 && WIFEXITED(rep.status) && WEXITSTATUS(rep.status))
+				syslog(LOG_ERR, "%s: %s: %d: child script with pid %d exited with non null exit value %d", __FILE__, __FUNCTION__, __LINE__, rep.pid, WEXITSTATUS(rep.status));
+			else if(cfg.debug >= 9)
+				syslog(LOG_ERR, "%s: %s: %d: child script with pid %d exited successfully", __FILE__, __FUNCTION__, __LINE__, rep.pid);
+		} else {
+			continue;
+		}
+
+		spawn_running--;
+		exec_queue_delete(rep.job);
+	}
+
+	spawn_lost("script spawner closed the channel");
+}
+
+/* 0 when sent, 1 when the channel is full, -1 when the helper is lost */
+static int spawn_send(const void *buf, size_t len)
+{
+	while(send(spawn_fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT) == -1) {
+		if(errno == EINTR) continue;
+		if(errno == EAGAIN) return(1);
+
+		spawn_lost(strerror(errno));
+		return(-1);
+	}
+
+	return(0);
+}
+
+/* send on as much of the backlog as the channel takes, nonzero when the helper is lost */
+static int spawn_flush(void)
+{
+	while(backlog_first) {
+		SPAWN_MSG *m = backlog_first;
+		int r = spawn_send(m->data, m->len);
+
+		if(r < 0) return(1);
+		if(r > 0) break;
+
+		backlog_first = m->next;
+		if(!backlog_first) backlog_last = NULL;
+		backlog_len--;
+		free(m);
+	}
+
+	return(0);
+}
+
+static void spawn_backlog_free(void)
+{
+	while(backlog_first) {
+		SPAWN_MSG *m = backlog_first;
+
+		backlog_first = m->next;
+		free(m);
+	}
+
+	backlog_last = NULL;
+	backlog_len = 0;
+}
+
+/* called as children of ours are reaped, the helper is picked up on the next use */
+void spawn_child_exited(pid_t pid)
+{
+	if(pid == spawn_pid) spawn_dead = 1;
+}
+
+/*
+  The helper is gone. What it was running is taken as done so that the
+  queues move on, and the next script starts a new helper.
+*/
+static void spawn_lost(const char *why)
+{
+	syslog(LOG_ERR, "%s: %s: lost script spawner, %s", __FILE__, __FUNCTION__, why);
+
+	if(spawn_fd != -1) close(spawn_fd);
+	if(spawn_pid && !spawn_dead) kill(spawn_pid, SIGTERM);
+
+	spawn_fd = -1;
+	spawn_pid = 0;
+	spawn_dead = 0;
+	spawn_running = 0;
+	spawn_backlog_free();
+
+	exec_queue_lost();
+}
+
+/* helper process side, never returns */
+static void spawn_server(int fd)
+{
+	static char buf[SPAWN_MSGSIZE];
+	SPAWN_KID *kids = NULL;
+	int nkids = 0, maxkids = 0;
+	struct pollfd pfd[2];
+	sigset_t mask;
+	long i, maxfd;
+	int sfd;
+
+	/* nothing of the daemon is needed here but the channel */
+	closelog();
+	maxfd = sysconf(_SC_OPEN_MAX);
+	for(i = 3; i < maxfd; i++) if(i != fd) close(i);
+	openlog("foolsm", LOG_PID, LOG_DAEMON);
+
+	signal(SIGHUP, SIG_IGN);
+	signal(SIGUSR1, SIG_IGN);
+	signal(SIGUSR2, SIG_IGN);
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	if((sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+		syslog(LOG_ERR, "%s: %s: signalfd failed \"%s\"", __FILE__, __FUNCTION__, strerror(errno));
+		_exit(1);
+	}
+
+	pfd[0].fd = fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = sfd;
+	pfd[1].events = POLLIN;
+
+	for(;;) {
+		if(poll(pfd, 2, -1) == -1) {
+			if(errno == EINTR) continue;
+			_exit(1);
+		}
+
+		if(pfd[1].revents) {
+			struct signalfd_siginfo si;
+
+			while(read(sfd, &si, sizeof(si)) == sizeof(si));
+			spawn_server_reap(fd, kids, &nkids);
+		}
+
+		if(pfd[0].revents) {
+			ssize_t n = recv(fd, buf, sizeof(buf), 0);
+
+			/* the daemon has gone away */
+			if(n == 0 || (n == -1 && errno != EINTR)) _exit(0);
+
+			if(n > 0 && ((SPAWN_REQ *)buf)->type == SPAWN_KILL) spawn_server_kill(buf, n, kids, nkids);
+			else if(n > 0) spawn_server_run(fd, buf, n, &kids, &nkids, &maxkids);
+		}
+	}
+}
+
+static int spawn_server_run(int fd, char *buf, int len, SPAWN_KID **kids, int *nkids, int *maxkids)
+{
+	static char **args = NULL;
+	static uint32_t maxargs = 0;
+	SPAWN_REQ *rq = (SPAWN_REQ *)buf;
+	char **argv, **envp, *p = buf + sizeof(SPAWN_REQ);
+	posix_spawnattr_t attr;
+	sigset_t none, dfl;
+	pid_t pid;
+	uint32_t i;
+	int err;
+
+	/* every request that names a job gets an answer, or the daemon waits for it forever */
+	if(len < (int)(2 * sizeof(uint32_t))) return(1);
+	if(len < (int)sizeof(SPAWN_REQ) || rq->type != SPAWN_RUN || rq->argc == 0) return(spawn_server_fail(fd, rq->job, EINVAL));
+
+	/* the pointer arrays are kept from one request to the next */
+	if(rq->argc + rq->envc + 2 > maxargs) {
+		char **a;
+		uint32_t n = rq->argc + rq->envc + 2 + 32;
+
+		if((a = realloc(args, n * sizeof(char *))) == NULL) return(spawn_server_fail(fd, rq->job, ENOMEM));
+		args = a;
+		maxargs = n;
+	}
+
+	argv = args;
+	envp = args + rq->argc + 1;
+
+	for(i = 0; i < rq->argc + rq->envc; i++) {
+		char *end = memchr(p, '\0', buf + len - p);
+
+		if(!end) return(spawn_server_fail(fd, rq->job, EINVAL));
+		if(i < rq->argc) argv[i] = p;
+		else envp[i - rq->argc] = p;
+		p = end + 1;
+	}
+	argv[rq->argc] = NULL;
+	envp[rq->envc] = NULL;
+
+	if(*nkids >= *maxkids) {
+		SPAWN_KID *k;
+		int n = *maxkids ? *maxkids * 2 : 16;
+
+		if((k = realloc(*kids, n * sizeof(SPAWN_KID))) == NULL) return(spawn_server_fail(fd, rq->job, ENOMEM));
+		*kids = k;
+		*maxkids = n;
+	}
+
+	/*
+	  Scripts start with no signal blocked, the default action for the
+	  signals the helper ignores, and a process group of their own so
+	  that a hung one can be killed along with the commands it runs.
+	*/
+	sigemptyset(&none);
+	sigemptyset(&dfl);
+	sigaddset(&dfl, SIGHUP);
+	sigaddset(&dfl, SIGUSR1);
+	sigaddset(&dfl, SIGUSR2);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigmask(&attr, &none);
+	posix_spawnattr_setsigdefault(&attr, &dfl);
+	posix_spawnattr_setpgroup(&attr, 0);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+
+	err = posix_spawn(&pid, argv[0], NULL, &attr, argv, envp);
+
+	posix_spawnattr_destroy(&attr);
+
+	if(err) return(spawn_server_fail(fd, rq->job, err));
+
+	(*kids)[*nkids].pid = pid;
+	(*kids)[*nkids].job = rq->job;
+	(*nkids)++;
+
+	return(0);
+}
+
+/* tell the daemon a job will not run */
+static int spawn_server_fail(int fd, uint32_t job, int err)
+{
+	SPAWN_REP rep;
+
+	memset(&rep, 0, sizeof(rep));
+	rep.type = SPAWN_FAILED;
+	rep.job = job;
+	rep.status = err;
+	send(fd, &rep, sizeof(rep), MSG_NOSIGNAL);
+
+	return(1);
+}
+
+static void spawn_server_reap(int fd, SPAWN_KID *kids, int *nkids)
+{
+	SPAWN_REP rep;
+	int status, i;
+	pid_t pid;
+
+	while((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		for(i = 0; i < *nkids; i++) {
+			if(kids[i].pid != pid) continue;
+
+			memset(&rep, 0, sizeof(rep));
+			rep.type = SPAWN_EXITED;
+			rep.job = kids[i].job;
+			rep.pid = pid;
+			rep.status = status;
+			send(fd, &rep, sizeof(rep), MSG_NOSIGNAL);
+
+			kids[i] = kids[--(*nkids)];
+			break;
+		}
+	}
+}
+
+static void spawn_server_kill(char *buf, int len, SPAWN_KID *kids, int nkids)
+{
+	SPAWN_REQ *rq = (SPAWN_REQ *)buf;
+	int i;
+
+	if(len < (int)sizeof(SPAWN_REQ)) return;
+
+	for(i = 0; i < nkids; i++) {
+		if(kids[i].job != rq->job) continue;
+
+		if(kill(-kids[i].pid, rq->sig) == -1) kill(kids[i].pid, rq->sig);
+		return;
+	}
+}
+
+/* EOF */
@@ -0,0 +1,48 @@
+/*
+
+  (C) 2026 Mika Ilmaranta <ilmis@nullnet.fi>
+
+  License: GPLv2
+
+*/
+
+#ifndef __SPAWN_H__
+#define __SPAWN_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* largest request, the argv and envp strings of one script included */
+#define SPAWN_MSGSIZE (65536)
+
+#define SPAWN_RUN    (0) /* main to helper, run argv with envp */
+#define SPAWN_EXITED (1) /* helper to main, the job has exited */
+#define SPAWN_FAILED (2) /* helper to main, the job could not be started */
+#define SPAWN_KILL   (3) /* main to helper, signal the process group of the job */
+
+/* a run request is followed by argc argv strings and envc envp strings, each nul terminated */
+typedef struct spawn_req {
+	uint32_t type;
+	uint32_t job;
+	uint32_t argc;
+	uint32_t envc;
+	uint32_t sig; /* signal to send with SPAWN_KILL */
+} SPAWN_REQ;
+
+typedef struct spawn_rep {
+	uint32_t type;
+	uint32_t job;
+	int32_t pid;
+	int32_t status; /* wait status, or errno when the job failed */
+} SPAWN_REP;
+
+int spawn_start(void);
+void spawn_stop(void);
+int spawn_job(char **argv, char **envp);
+int spawn_kill(int job, int sig);
+void spawn_poll(void);
+void spawn_child_exited(pid_t pid);
+
+#endif
+
+/* EOF */
@@ -0,0 +1,187 @@
+/*
+
+  (C) 2026 Mika Ilmaranta <ilmis@nullnet.fi>
+
+  License: GPLv2
+
+  Times running N scripts through the spawn helper against forking
+  and execing them from the calling process, as foolsm did before.
+  The caller can be grown with -m to see what its size costs fork.
+
+  usage: spawn_bench [-n count] [-m megabytes] [script [args]]
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "config.h"
+#include "spawn.h"
+
+/* what spawn.o needs from the rest of foolsm */
+GLOBAL cfg;
+
+static int bench_done = 0;
+
+void exec_queue_delete(int job)
+{
+	bench_done++;
+}
+
+void exec_queue_lost(void)
+{
+	fprintf(stderr, "script spawner lost\n");
+	exit(1);
+}
+
+/* scripts out at a time, well below what the helper backlog holds */
+#define BENCH_WINDOW (64)
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/* cpu time of the caller alone, that is what the probe loop loses */
+static double bench_cpu(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	return(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6);
+}
+
+/* foolsm reads replies as its loop comes round, do not spin on them here */
+static void bench_wait(void)
+{
+	struct timespec ts = { 0, 20000 };
+
+	spawn_poll();
+	nanosleep(&ts, NULL);
+}
+
+static void bench_report(const char *what, int n, double wall, double cpu)
+{
+	printf("%-8s %6d scripts  wall %9.3f ms  caller cpu %9.3f ms  %8.1f us/script\n",
+		what, n, wall * 1e3, cpu * 1e3, cpu * 1e6 / n);
+}
+
+static void bench_helper(int n, char **argv, char **envp)
+{
+	double wall, cpu;
+	int i;
+
+	bench_done = 0;
+	wall = bench_now();
+	cpu = bench_cpu();
+
+	for(i = 0; i < n; i++) {
+		while(i - bench_done >= BENCH_WINDOW) bench_wait();
+
+		if(spawn_job(argv, envp) == 0) {
+			fprintf(stderr, "failed to hand %s over to the script spawner\n", argv[0]);
+			exit(1);
+		}
+	}
+
+	while(bench_done < n) bench_wait();
+
+	bench_report("helper", n, bench_now() - wall, bench_cpu() - cpu);
+}
+
+static void bench_fork(int n, char **argv, char **envp)
+{
+	double wall, cpu;
+	pid_t pid;
+	int i, out = 0;
+
+	wall = bench_now();
+	cpu = bench_cpu();
+
+	for(i = 0; i < n; i++) {
+		while(out >= BENCH_WINDOW) {
+			if(waitpid(-1, NULL, 0) > 0) out--;
+		}
+
+		if((pid = fork()) == -1) {
+			perror("fork");
+			exit(1);
+		}
+
+		if(pid == 0) {
+			execve(argv[0], argv, envp);
+			_exit(127);
+		}
+		out++;
+	}
+
+	while(out > 0) {
+		if(waitpid(-1, NULL, 0) > 0) out--;
+	}
+
+	bench_report("fork", n, bench_now() - wall, bench_cpu() - cpu);
+}
+
+int main(int argc, char **argv)
+{
+	static char *true_argv[] = { "/bin/true", NULL };
+	static char *envp[] = { "LANG=C", "PATH=/bin:/usr/bin:/sbin:/usr/sbin", NULL };
+	char **script = true_argv;
+	size_t mb = 0;
+	int n = 1000;
+	int opt;
+
+	while((opt = getopt(argc, argv, "n:m:")) != -1) {
+		switch(opt) {
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 'm':
+			mb = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n count] [-m megabytes] [script [args]]\n", argv[0]);
+			return(1);
+		}
+	}
+
+	if(n <= 0) n = 1;
+	if(optind < argc) script = argv + optind;
+
+	/* foolsm starts the helper while it is still small, do the same */
+	if(spawn_start()) {
+		fprintf(stderr, "failed to start script spawner\n");
+		return(1);
+	}
+
+	if(mb) {
+		char *ballast;
+
+		if((ballast = malloc(mb << 20)) == NULL) {
+			perror("malloc");
+			return(1);
+		}
+		memset(ballast, 1, mb << 20);
+	}
+
+	bench_helper(n, script, envp);
+	bench_fork(n, script, envp);
+
+	spawn_stop();
+
+	return(0);
+}
+
+/* EOF */
@@ -5,52 +5,48 @@
 */
 
 #include <syslog.h>
+#include <string.h>
+#include <errno.h>
 
 #include "defs.h"
 #include "timecalc.h"
 
-int timeval_diff_cmp(struct timeval *a, struct timeval *b, int operation, time_t sec, suseconds_t usec) {
-	time_t diff_sec;
-	suseconds_t diff_usec;
+/* CLOCK_REALTIME - CLOCK_MONOTONIC as of the last nstime_now() */
+static int64_t real_offset = 0;
 
-	diff_sec = a->tv_sec - b->tv_sec;
-	diff_usec = a->tv_usec - b->tv_usec;
+static int64_t ts_ns(const struct timespec *ts)
+{
+	return((int64_t)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec);
+}
 
-	if(diff_usec < 0) {
-		diff_sec--;
-		diff_usec = 1000000L + diff_usec;
-	}
+/*
+  Current monotonic time. Called once per pass of the main loop, the
+  result is handed down to everything timed during that pass.
+*/
+int64_t nstime_now(void)
+{
+	struct timespec mono, real;
 
-	switch(operation) {
-	case TIMEVAL_DIFF_CMP_GT:
-		if(diff_sec > sec) return(TRUE);
-		if(diff_sec == sec && diff_usec > usec) return(TRUE);
-		return(FALSE);
-		break;
-	case TIMEVAL_DIFF_CMP_LT:
-		if(diff_sec < sec) return(TRUE);
-		if(diff_sec == sec && diff_usec < usec) return(TRUE);
-		return(FALSE);
-		break;
-	default:
-		syslog(LOG_ERR, "%s: %s: warning: unknown timeval_diff_cmp operation requested %d", __FILE__, __FUNCTION__, operation);
-		return(FALSE);
+	if(clock_gettime(CLOCK_MONOTONIC, &mono) == -1) {
+		syslog(LOG_ERR, "%s: %s: clock_gettime failed \"%s\"", __FILE__, __FUNCTION__, strerror(errno));
+		return(0);
 	}
+
+	if(clock_gettime(CLOCK_REALTIME, &real) == 0) real_offset = ts_ns(&real) - ts_ns(&mono);
+
+	return(ts_ns(&mono));
 }
 
-long timeval_diff(struct timeval *a, struct timeval *b)
+/* kernel socket timestamps are wall clock, move them onto the monotonic base */
+int64_t nstime_from_real(const struct timespec *ts)
 {
-	return( ((a->tv_sec - b->tv_sec) * 1000000L) + (a->tv_usec - b->tv_usec) );
+	return(ts_ns(ts) - real_offset);
 }
 
-void timeval_add(struct timeval *a, time_t sec, suseconds_t usec)
+/* seconds since the epoch for event scripts and exports */
+time_t nstime_wall(int64_t t)
 {
-	a->tv_sec += sec;
-	a->tv_usec += usec;
-	if(a->tv_usec >= 1000000L) {
-		a->tv_sec++;
-		a->tv_usec -= 1000000L;
-	}
+	return((time_t)((t + real_offset) / NSEC_PER_SEC));
 }
 
 /* EOF */
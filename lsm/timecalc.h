@@ -7,15 +7,20 @@
 #ifndef __TIMECALC_H__
 #define __TIMECALC_H__
 
+#include <stdint.h>
 #include <time.h>
-#include <sys/time.h>
 
-#define TIMEVAL_DIFF_CMP_GT (0)
-#define TIMEVAL_DIFF_CMP_LT (1)
+/*
+  All probe timing is kept in int64_t nanoseconds of CLOCK_MONOTONIC so
+  wall clock steps do not disturb timeouts and round trip times.
+*/
+#define NSEC_PER_SEC  (1000000000LL)
+#define NSEC_PER_MSEC (1000000LL)
+#define NSEC_PER_USEC (1000LL)
 
-int timeval_diff_cmp(struct timeval *a, struct timeval *b, int operation, time_t sec, suseconds_t usec);
-long timeval_diff(struct timeval *a, struct timeval *b);
-void timeval_add(struct timeval *a, time_t sec, suseconds_t usec);
+int64_t nstime_now(void);
+int64_t nstime_from_real(const struct timespec *ts);
+time_t nstime_wall(int64_t t);
 
 #endif
 
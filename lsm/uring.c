@@ -0,0 +1,283 @@
+/*
+
+  (C) 2026 Mika Ilmaranta <ilmis@nullnet.fi>
+
+  License: GPLv2
+
+*/
+
+/*
+  Minimal io_uring ring handling on top of the raw system calls, so no
+  liburing is needed. There is one ring per process with a single
+  provided buffer ring for multishot receives.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+#ifdef HAVE_IO_URING
+
+static int ring_fd = -1;
+
+static void *sq_ptr = NULL, *cq_ptr = NULL;
+static size_t sq_len = 0, cq_len = 0;
+static struct io_uring_sqe *sqes = NULL;
+static size_t sqes_len = 0;
+
+static unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+static unsigned int sq_entries, sqe_tail;
+static unsigned int *cq_head, *cq_tail, *cq_mask;
+static struct io_uring_cqe *cqes;
+
+static struct io_uring_buf_ring *br = NULL;
+static size_t br_len = 0;
+static char *br_mem = NULL;
+static unsigned int br_count = 0, br_size = 0;
+static unsigned short br_tail = 0;
+
+int uring_init(unsigned int entries)
+{
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+
+	if((ring_fd = syscall(__NR_io_uring_setup, entries, &p)) < 0) {
+		syslog(LOG_ERR, "%s: %s: io_uring_setup failed \"%s\"", __FILE__, __FUNCTION__, strerror(errno));
+		ring_fd = -1;
+		return(1);
+	}
+
+	/* the wait timeout is passed with IORING_ENTER_EXT_ARG */
+	if(!(p.features & IORING_FEAT_EXT_ARG)) {
+		syslog(LOG_ERR, "%s: %s: kernel io_uring lacks IORING_FEAT_EXT_ARG", __FILE__, __FUNCTION__);
+		uring_free();
+		return(1);
+	}
+
+	sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if(p.features & IORING_FEAT_SINGLE_MMAP) {
+		if(cq_len > sq_len) sq_len = cq_len;
+		cq_len = 0;
+	}
+
+	sq_ptr = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	if(sq_ptr == MAP_FAILED) {
+		sq_ptr = NULL;
+		syslog(LOG_ERR, "%s: %s: failed to map submission ring \"%s\"", __FILE__, __FUNCTION__, strerror(errno));
+		uring_free();
+		return(1);
+	}
+
+	if(cq_len) {
+		cq_ptr = mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+		if(cq_ptr == MAP_FAILED) {
+			cq_ptr = NULL;
+			syslog(LOG_ERR, "%s: %s: failed to map completion ring \"%s\"", __FILE__, __FUNCTION__, strerror(errno));
+			uring_free();
+			return(1);
+		}
+	}
+
+	sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	sqes = mmap(NULL, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if(sqes == MAP_FAILED) {
+		sqes = NULL;
+		syslog(LOG_ERR, "%s: %s: failed to map submission entries \"%s\"", __FILE__, __FUNCTION__, strerror(errno));
+		uring_free();
+		return(1);
+	}
+
+	sq_head = (unsigned int *)((char *)sq_ptr + p.sq_off.head);
+	sq_tail = (unsigned int *)((char *)sq_ptr + p.sq_off.tail);
+	sq_mask = (unsigned int *)((char *)sq_ptr + p.sq_off.ring_mask);
+	sq_array = (unsigned int *)((char *)sq_ptr + p.sq_off.array);
+	sq_entries = p.sq_entries;
+	sqe_tail = *sq_tail;
+
+	{
+		char *base = cq_ptr ? cq_ptr : sq_ptr;
+
+		cq_head = (unsigned int *)(base + p.cq_off.head);
+		cq_tail = (unsigned int *)(base + p.cq_off.tail);
+		cq_mask = (unsigned int *)(base + p.cq_off.ring_mask);
+		cqes = (struct io_uring_cqe *)(base + p.cq_off.cqes);
+	}
+
+	return(0);
+}
+
+void uring_free(void)
+{
+	if(br) {
+		munmap(br, br_len);
+		br = NULL;
+	}
+	if(br_mem) {
+		free(br_mem);
+		br_mem = NULL;
+	}
+	if(sqes) {
+		munmap(sqes, sqes_len);
+		sqes = NULL;
+	}
+	if(cq_ptr) {
+		munmap(cq_ptr, cq_len);
+		cq_ptr = NULL;
+	}
+	if(sq_ptr) {
+		munmap(sq_ptr, sq_len);
+		sq_ptr = NULL;
+	}
+	if(ring_fd != -1) {
+		close(ring_fd);
+		ring_fd = -1;
+	}
+}
+
+/* next free submission entry, submits what is queued if the ring is full */
+struct io_uring_sqe *uring_get_sqe(void)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int idx;
+
+	if(sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+		uring_enter(0, -1);
+		if(sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) return(NULL);
+	}
+
+	idx = sqe_tail & *sq_mask;
+	sqe = &sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sq_array[idx] = idx;
+	sqe_tail++;
+
+	return(sqe);
+}
+
+/*
+  Submit the queued entries and optionally wait for wait_nr completions,
+  at most usec microseconds when usec is not negative.
+*/
+int uring_enter(unsigned int wait_nr, long usec)
+{
+	unsigned int to_submit, flags = 0;
+	int ret;
+
+	__atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+	to_submit = sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+
+	if(wait_nr) flags |= IORING_ENTER_GETEVENTS;
+
+	if(wait_nr && usec >= 0) {
+		struct io_uring_getevents_arg arg;
+		struct __kernel_timespec ts;
+
+		memset(&arg, 0, sizeof(arg));
+		ts.tv_sec = usec / 1000000L;
+		ts.tv_nsec = (usec % 1000000L) * 1000L;
+		arg.ts = (unsigned long)&ts;
+
+		ret = syscall(__NR_io_uring_enter, ring_fd, to_submit, wait_nr, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	} else {
+		ret = syscall(__NR_io_uring_enter, ring_fd, to_submit, wait_nr, flags, NULL, 0);
+	}
+
+	if(ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+		syslog(LOG_INFO, "%s: %s: io_uring_enter failed \"%s\"", __FILE__, __FUNCTION__, strerror(errno));
+		return(-1);
+	}
+
+	return(0);
+}
+
+struct io_uring_cqe *uring_peek_cqe(void)
+{
+	unsigned int head = *cq_head;
+
+	if(head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) return(NULL);
+
+	return(&cqes[head & *cq_mask]);
+}
+
+void uring_cqe_seen(void)
+{
+	__atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+  Register count buffers of size bytes as buffer group bgid. count must
+  be a power of two.
+*/
+int uring_bufs_init(unsigned short bgid, unsigned int count, unsigned int size)
+{
+	struct io_uring_buf_reg reg;
+	unsigned int i;
+
+	br_len = count * sizeof(struct io_uring_buf);
+	br = mmap(NULL, br_len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if(br == MAP_FAILED) {
+		br = NULL;
+		syslog(LOG_ERR, "%s: %s: failed to map buffer ring \"%s\"", __FILE__, __FUNCTION__, strerror(errno));
+		return(1);
+	}
+
+	if((br_mem = malloc((size_t)count * size)) == NULL) {
+		syslog(LOG_ERR, "%s: %s: failed to malloc receive buffers", __FILE__, __FUNCTION__);
+		return(1);
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long)br;
+	reg.ring_entries = count;
+	reg.bgid = bgid;
+
+	if(syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		syslog(LOG_ERR, "%s: %s: failed to register buffer ring \"%s\"", __FILE__, __FUNCTION__, strerror(errno));
+		return(1);
+	}
+
+	br_count = count;
+	br_size = size;
+	br_tail = 0;
+
+	for(i = 0; i < count; i++) uring_buf_recycle(i);
+	uring_bufs_commit();
+
+	return(0);
+}
+
+char *uring_buf(unsigned short bid)
+{
+	return(br_mem + (size_t)bid * br_size);
+}
+
+/* hand a buffer back to the kernel, visible after uring_bufs_commit() */
+void uring_buf_recycle(unsigned short bid)
+{
+	struct io_uring_buf *buf = &br->bufs[br_tail & (br_count - 1)];
+
+	buf->addr = (unsigned long)uring_buf(bid);
+	buf->len = br_size;
+	buf->bid = bid;
+	br_tail++;
+}
+
+void uring_bufs_commit(void)
+{
+	__atomic_store_n(&br->tail, br_tail, __ATOMIC_RELEASE);
+}
+
+#endif
+
+/* EOF */
@@ -0,0 +1,43 @@
+/*
+
+  (C) 2026 Mika Ilmaranta <ilmis@nullnet.fi>
+
+  License: GPLv2
+
+*/
+
+#ifndef __URING_H__
+#define __URING_H__
+
+/*
+  The io_uring backend is built when the kernel headers know about
+  multishot receive. Define NO_IO_URING to leave it out altogether.
+*/
+#if !defined(NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_ASYNC_CANCEL_FD)
+#define HAVE_IO_URING
+#endif
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+int uring_init(unsigned int entries);
+void uring_free(void);
+struct io_uring_sqe *uring_get_sqe(void);
+int uring_enter(unsigned int wait_nr, long usec);
+struct io_uring_cqe *uring_peek_cqe(void);
+void uring_cqe_seen(void);
+
+int uring_bufs_init(unsigned short bgid, unsigned int count, unsigned int size);
+char *uring_buf(unsigned short bid);
+void uring_buf_recycle(unsigned short bid);
+void uring_bufs_commit(void);
+
+#endif
+
+#endif
+
+/* EOF */
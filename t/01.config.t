@@ -5,9 +5,10 @@
 
 use strict;
 use FindBin '$Bin';
+use File::Temp;
 use lib $Bin,"$Bin/../lib";
 
-use Test::More tests=>45;
+use Test::More tests=>51;
 
 my $dummy_data = {
     ip_addr_show =><<'EOF',
@@ -174,6 +175,25 @@ ok($output =~ m!ip route add 10.10.10.10/8 dev wlan0 table 1!,
 ok($output =~ m!iptables -I FORWARD -i eth1 -s 192.168.10.0/24 -o wlan0 -d 10.10.10.10/8 -j ACCEPT!,
    'add_route firewall');
 
+# a degraded service only carries traffic when no service is up
+$bal->lsm_state_dir(File::Temp::tempdir(CLEANUP=>1));
+$bal->event(CABLE => 'up');
+my $state = $bal->event(DSL => 'degraded');
+is($state->{DSL},'degraded','degraded state recorded');
+is(join(',',sort $bal->up),'CABLE','degraded service drained while another is up');
+$bal->event(CABLE => 'down');
+is(join(',',sort $bal->up),'DSL','degraded service used when none is up');
+
+# eventscript arguments, one event or a batch of them
+my @one = ('up','CABLE','8.8.8.8','eth0','admin@dummy_host.om',(0) x 17);
+my @two = ('down','DSL','8.8.4.4','ppp0','admin@dummy_host.om',(1) x 17);
+my @events = $bal->lsm_events(@one);
+is_deeply(\@events,[\@one],'single event passed through');
+@events = $bal->lsm_events(batch => 2,@one,@two);
+is_deeply(\@events,[\@one,\@two],'batch split into events');
+@events = $bal->lsm_events(batch => 1,@two);
+is_deeply(\@events,[\@two],'batch of one split');
+
 # now we test failover-only mode
 $bal = Net::ISP::Balance->new("$Bin/etc/balance_failover.conf",
 			      dummy_test_data=>$dummy_data,